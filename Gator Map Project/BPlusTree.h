@@ -0,0 +1,897 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include "NameIndex.h"
+#include "Memory.h"
+#include "NodePool.h"
+#include "OutputSink.h"
+#include "Stats.h"
+using std::string;
+
+// B+ tree alternative to the AVL behind OrderedMap. Every entry lives in a leaf and
+// the inner nodes only route searches, so with 32-way nodes a tree of 10M entries is
+// about 5 levels deep instead of the AVL's ~28. Each node keeps its keys in one contiguous
+// array (two cache lines for int keys), so a lookup costs a handful of cache misses per level
+// rather than one miss per comparison. Values sit in a separate array of the leaf and are only
+// touched once the right slot has been found. Key and Value must be default constructible,
+// since every slot of a node holds one whether it is in use or not.
+//
+// Exposes the same functions as AVL that OrderedMap relies on, so either one can be
+// plugged into BasicOrderedMap.
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class BPlusTree {
+private:
+    static const int LEAF_CAPACITY = 32;            // entries per leaf
+    static const int INNER_CAPACITY = 32;           // children per inner node
+    static const int LEAF_MIN = LEAF_CAPACITY / 2;  // every node but the root stays at least half full
+    static const int INNER_MIN = INNER_CAPACITY / 2;
+
+    struct Node {
+        bool isLeaf;
+        int count; // entries in a leaf, children in an inner node
+        explicit Node(bool leaf) { isLeaf = leaf; count = 0; }
+    };
+
+    // leaves are linked left to right so ordered scans never go back up the tree
+    struct Leaf : Node {
+        Key keys[LEAF_CAPACITY];
+        Leaf* next = nullptr;
+        Value values[LEAF_CAPACITY];
+        Leaf() : Node(true) {}
+    };
+
+    // keys[i] separates children[i] and children[i + 1]: every key under children[i + 1] is >= keys[i]
+    // and every key under children[i] is smaller. sizes[i] counts the entries under children[i],
+    // which makes select()/rank() O(log n) like the AVL's sub-tree sizes
+    struct Inner : Node {
+        Key keys[INNER_CAPACITY - 1];
+        Node* children[INNER_CAPACITY];
+        unsigned int sizes[INNER_CAPACITY];
+        Inner() : Node(false) {}
+    };
+
+    Node* root = nullptr;
+    unsigned int entryCount = 0;
+    NodePool<Leaf> leafPool{64};
+    NodePool<Inner> innerPool{64};
+    NameIndex<Key, Value, Compare> nameIndex;
+    Compare compare;
+    MAP_STAT(uint64_t splits = 0; uint64_t merges = 0; uint64_t borrows = 0;) // only in MAP_STATS builds, see Stats.h
+
+    // helper functions meant to be called through external functions
+    template <typename... Args>
+    bool helperInsert(const Key& key, bool overwrite, Args&&... args);
+    template <typename... Args>
+    Node* insertInto(Node* node, const Key& key, bool overwrite, bool& existed, Key& splitKey, Args&&... args);
+    bool helperRemove(Node* node, const Key& key);
+    Leaf* helperSearchID(const Key& key, int& position) const;
+    void helperDestroy(Node* node);
+    static void helperHeapBytes(const Node* node, MemoryUsage& usage);
+
+    // internal functions for splitting/merging nodes
+    int childIndex(const Inner* node, const Key& key) const;
+    int leafPosition(const Leaf* leaf, const Key& key) const;
+    static unsigned int subtreeSize(const Node* node);
+    Leaf* splitLeaf(Leaf* leaf);
+    Inner* splitInner(Inner* inner, Key& middleKey);
+    void insertChild(Inner* inner, int position, const Key& separator, Node* child);
+    void fixUnderflow(Inner* inner, int index);
+    void borrowFromLeft(Inner* inner, int index);
+    void borrowFromRight(Inner* inner, int index);
+    void mergeChildren(Inner* inner, int index);
+    Leaf* firstLeaf() const;
+
+public:
+    class Iterator;
+    using KeyType = Key;
+    using ValueType = Value;
+    using CompareType = Compare;
+
+    BPlusTree() = default;
+    ~BPlusTree();
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    // main functions
+    bool insert(const Key& key, const Value& value);
+    bool insert(const Key& key, Value&& value);
+    template <typename... Args>
+    bool emplace(const Key& key, Args&&... args);
+    bool upsert(const Key& key, const Value& value);
+    bool upsert(const Key& key, Value&& value);
+    bool remove(const Key& key);
+    const Value* search(const Key& key) const;
+    std::vector<Key> keysWithValue(const Value& value);
+    void enableNameIndex(bool enable);
+    string preorderPrint();
+    void preorderPrint(std::ostream& out);
+    template <typename Visitor>
+    void visitInorder(Visitor visit);
+    bool select(unsigned int index, Key& key) const;
+    unsigned int rank(const Key& key) const;
+    bool removeNth(unsigned int index);
+    unsigned int getNodeCount() const;
+    void clear();
+    unsigned int bulkLoad(std::vector<std::pair<Key, Value>> records);
+    void stats(TreeStats& result) const;
+    void resetStats();
+    MemoryUsage memoryUsage() const;
+
+    // ordered access. iterators visit entries in ascending key order and are invalidated by insert/remove
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lowerBound(const Key& key) const;
+    Iterator upperBound(const Key& key) const;
+    const Compare& keyCompare() const;
+
+    // cursor over the linked leaves: the current leaf and a slot inside it
+    class Iterator {
+    private:
+        const Leaf* leaf = nullptr;
+        int position = 0;
+
+    public:
+        Iterator& operator++();
+        bool operator!=(Iterator const& rhs) const;
+        bool operator==(Iterator const& rhs) const;
+        std::pair<const Key&, const Value&> operator*() const;
+        const Key& key() const;
+        const Value& value() const;
+        friend class BPlusTree;
+    };
+};
+
+// index of the child of inner that key belongs under
+template <typename Key, typename Value, typename Compare>
+int BPlusTree<Key, Value, Compare>::childIndex(const Inner* node, const Key& key) const {
+    return (int)(std::upper_bound(node->keys, node->keys + node->count - 1, key, compare) - node->keys);
+}
+
+// first slot of leaf whose key is not less than key
+template <typename Key, typename Value, typename Compare>
+int BPlusTree<Key, Value, Compare>::leafPosition(const Leaf* leaf, const Key& key) const {
+    return (int)(std::lower_bound(leaf->keys, leaf->keys + leaf->count, key, compare) - leaf->keys);
+}
+
+// number of entries under node. O(fanout) for an inner node, which only ever happens next to a split or merge
+template <typename Key, typename Value, typename Compare>
+unsigned int BPlusTree<Key, Value, Compare>::subtreeSize(const Node* node) {
+    if (node->isLeaf)
+        return node->count;
+    const Inner* inner = static_cast<const Inner*>(node);
+    unsigned int total = 0;
+    for (int i = 0; i < inner->count; i++)
+        total += inner->sizes[i];
+    return total;
+}
+
+// helper function for inserting into the tree. the value is built from args only once it is
+// known to be needed. returns true if key already existed
+template <typename Key, typename Value, typename Compare>
+template <typename... Args>
+bool BPlusTree<Key, Value, Compare>::helperInsert(const Key& key, bool overwrite, Args&&... args) {
+    if (this->root == nullptr)
+        this->root = leafPool.create();
+    bool existed = false;
+    Key splitKey{};
+    Node* sibling = insertInto(this->root, key, overwrite, existed, splitKey, std::forward<Args>(args)...);
+    // the root itself split, so the tree grows one level taller
+    if (sibling != nullptr) {
+        Inner* newRoot = innerPool.create();
+        newRoot->count = 2;
+        newRoot->children[0] = this->root;
+        newRoot->children[1] = sibling;
+        newRoot->keys[0] = splitKey;
+        newRoot->sizes[0] = subtreeSize(this->root);
+        newRoot->sizes[1] = subtreeSize(sibling);
+        this->root = newRoot;
+    }
+    return existed;
+}
+
+// recursive part of the insert. the tree is only a few levels deep, so the recursion is shallow.
+// when node has to split, the new right half is returned and its smallest key is stored in splitKey
+template <typename Key, typename Value, typename Compare>
+template <typename... Args>
+typename BPlusTree<Key, Value, Compare>::Node* BPlusTree<Key, Value, Compare>::insertInto(Node* node, const Key& key, bool overwrite, bool& existed, Key& splitKey, Args&&... args) {
+    if (node->isLeaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int position = leafPosition(leaf, key);
+        if (position < leaf->count && !compare(key, leaf->keys[position])) {
+            existed = true;
+            if (overwrite) {
+                Value value(std::forward<Args>(args)...);
+                nameIndex.remove(leaf->values[position], key);
+                leaf->values[position] = std::move(value);
+                nameIndex.add(leaf->values[position], key);
+            }
+            return nullptr;
+        }
+
+        Leaf* sibling = nullptr;
+        if (leaf->count == LEAF_CAPACITY) {
+            sibling = splitLeaf(leaf);
+            if (position > leaf->count) { // the new entry belongs in the right half
+                position -= leaf->count;
+                leaf = sibling;
+            }
+        }
+        // shift the larger entries over by one and drop the new one in
+        std::move_backward(leaf->keys + position, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::move_backward(leaf->values + position, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+        leaf->keys[position] = key;
+        leaf->values[position] = Value(std::forward<Args>(args)...);
+        leaf->count++;
+        entryCount++;
+        nameIndex.add(leaf->values[position], key);
+
+        if (sibling != nullptr)
+            splitKey = sibling->keys[0];
+        return sibling;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int index = childIndex(inner, key);
+    Key childSplitKey{};
+    Node* newChild = insertInto(inner->children[index], key, overwrite, existed, childSplitKey, std::forward<Args>(args)...);
+    if (existed)
+        return nullptr;
+    if (newChild == nullptr) {
+        inner->sizes[index]++;
+        return nullptr;
+    }
+
+    // the child split in two: recount it and add the new half right after it
+    inner->sizes[index] = subtreeSize(inner->children[index]);
+    Inner* sibling = nullptr;
+    if (inner->count == INNER_CAPACITY) {
+        sibling = splitInner(inner, splitKey);
+        if (index >= inner->count) {
+            index -= inner->count;
+            inner = sibling;
+        }
+    }
+    insertChild(inner, index + 1, childSplitKey, newChild);
+    return sibling;
+}
+
+// moves the upper half of a full leaf into a new leaf linked after it
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::splitLeaf(Leaf* leaf) {
+    MAP_STAT(splits++;)
+    Leaf* sibling = leafPool.create();
+    int keep = LEAF_CAPACITY / 2;
+    sibling->count = leaf->count - keep;
+    std::move(leaf->keys + keep, leaf->keys + leaf->count, sibling->keys);
+    std::move(leaf->values + keep, leaf->values + leaf->count, sibling->values);
+    leaf->count = keep;
+    sibling->next = leaf->next;
+    leaf->next = sibling;
+    return sibling;
+}
+
+// moves the upper half of a full inner node into a new node. the key between the two
+// halves no longer belongs to either of them and is handed back in middleKey for the parent
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Inner* BPlusTree<Key, Value, Compare>::splitInner(Inner* inner, Key& middleKey) {
+    MAP_STAT(splits++;)
+    Inner* sibling = innerPool.create();
+    int keep = INNER_CAPACITY / 2;
+    middleKey = inner->keys[keep - 1];
+    sibling->count = inner->count - keep;
+    std::move(inner->keys + keep, inner->keys + inner->count - 1, sibling->keys);
+    std::copy(inner->children + keep, inner->children + inner->count, sibling->children);
+    std::copy(inner->sizes + keep, inner->sizes + inner->count, sibling->sizes);
+    inner->count = keep;
+    return sibling;
+}
+
+// inserts child at children[position], with separator in front of it
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::insertChild(Inner* inner, int position, const Key& separator, Node* child) {
+    std::copy_backward(inner->children + position, inner->children + inner->count, inner->children + inner->count + 1);
+    std::copy_backward(inner->sizes + position, inner->sizes + inner->count, inner->sizes + inner->count + 1);
+    std::move_backward(inner->keys + position - 1, inner->keys + inner->count - 1, inner->keys + inner->count);
+    inner->keys[position - 1] = separator;
+    inner->children[position] = child;
+    inner->sizes[position] = subtreeSize(child);
+    inner->count++;
+}
+
+// recursive part of remove. a child left less than half full is topped up from a sibling,
+// or merged with one, on the way back up. returns false if key was not found
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::helperRemove(Node* node, const Key& key) {
+    if (node->isLeaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int position = leafPosition(leaf, key);
+        if (position == leaf->count || compare(key, leaf->keys[position]))
+            return false;
+        nameIndex.remove(leaf->values[position], key);
+        std::move(leaf->keys + position + 1, leaf->keys + leaf->count, leaf->keys + position);
+        std::move(leaf->values + position + 1, leaf->values + leaf->count, leaf->values + position);
+        leaf->count--;
+        leaf->keys[leaf->count] = Key(); // release the moved-from slot's buffers
+        leaf->values[leaf->count] = Value();
+        entryCount--;
+        return true;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int index = childIndex(inner, key);
+    if (!helperRemove(inner->children[index], key))
+        return false;
+    inner->sizes[index]--;
+    Node* child = inner->children[index];
+    if (child->count < (child->isLeaf ? LEAF_MIN : INNER_MIN))
+        fixUnderflow(inner, index);
+    return true;
+}
+
+// restores the minimum fill of inner->children[index]: borrow one entry from a sibling that
+// can spare it, otherwise merge with a sibling
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::fixUnderflow(Inner* inner, int index) {
+    int minimum = inner->children[index]->isLeaf ? LEAF_MIN : INNER_MIN;
+    if (index > 0 && inner->children[index - 1]->count > minimum)
+        borrowFromLeft(inner, index);
+    else if (index + 1 < inner->count && inner->children[index + 1]->count > minimum)
+        borrowFromRight(inner, index);
+    else if (index > 0)
+        mergeChildren(inner, index - 1);
+    else if (index + 1 < inner->count)
+        mergeChildren(inner, index);
+}
+
+// moves the last entry (or child) of the left sibling to the front of children[index]
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::borrowFromLeft(Inner* inner, int index) {
+    MAP_STAT(borrows++;)
+    Node* left = inner->children[index - 1];
+    Node* child = inner->children[index];
+    if (child->isLeaf) {
+        Leaf* leftLeaf = static_cast<Leaf*>(left);
+        Leaf* childLeaf = static_cast<Leaf*>(child);
+        std::move_backward(childLeaf->keys, childLeaf->keys + childLeaf->count, childLeaf->keys + childLeaf->count + 1);
+        std::move_backward(childLeaf->values, childLeaf->values + childLeaf->count, childLeaf->values + childLeaf->count + 1);
+        childLeaf->keys[0] = leftLeaf->keys[leftLeaf->count - 1];
+        childLeaf->values[0] = std::move(leftLeaf->values[leftLeaf->count - 1]);
+        leftLeaf->count--;
+        childLeaf->count++;
+        inner->keys[index - 1] = childLeaf->keys[0];
+    }
+    else {
+        // rotate through the parent: its separator comes down in front of child and the
+        // left sibling's last key goes up to replace it
+        Inner* leftInner = static_cast<Inner*>(left);
+        Inner* childInner = static_cast<Inner*>(child);
+        std::copy_backward(childInner->children, childInner->children + childInner->count, childInner->children + childInner->count + 1);
+        std::copy_backward(childInner->sizes, childInner->sizes + childInner->count, childInner->sizes + childInner->count + 1);
+        std::move_backward(childInner->keys, childInner->keys + childInner->count - 1, childInner->keys + childInner->count);
+        childInner->keys[0] = inner->keys[index - 1];
+        childInner->children[0] = leftInner->children[leftInner->count - 1];
+        childInner->sizes[0] = leftInner->sizes[leftInner->count - 1];
+        inner->keys[index - 1] = leftInner->keys[leftInner->count - 2];
+        leftInner->count--;
+        childInner->count++;
+    }
+    inner->sizes[index - 1] = subtreeSize(left);
+    inner->sizes[index] = subtreeSize(child);
+}
+
+// moves the first entry (or child) of the right sibling to the end of children[index]
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::borrowFromRight(Inner* inner, int index) {
+    MAP_STAT(borrows++;)
+    Node* child = inner->children[index];
+    Node* right = inner->children[index + 1];
+    if (child->isLeaf) {
+        Leaf* childLeaf = static_cast<Leaf*>(child);
+        Leaf* rightLeaf = static_cast<Leaf*>(right);
+        childLeaf->keys[childLeaf->count] = rightLeaf->keys[0];
+        childLeaf->values[childLeaf->count] = std::move(rightLeaf->values[0]);
+        childLeaf->count++;
+        std::move(rightLeaf->keys + 1, rightLeaf->keys + rightLeaf->count, rightLeaf->keys);
+        std::move(rightLeaf->values + 1, rightLeaf->values + rightLeaf->count, rightLeaf->values);
+        rightLeaf->count--;
+        inner->keys[index] = rightLeaf->keys[0];
+    }
+    else {
+        Inner* childInner = static_cast<Inner*>(child);
+        Inner* rightInner = static_cast<Inner*>(right);
+        childInner->keys[childInner->count - 1] = inner->keys[index];
+        childInner->children[childInner->count] = rightInner->children[0];
+        childInner->sizes[childInner->count] = rightInner->sizes[0];
+        childInner->count++;
+        inner->keys[index] = rightInner->keys[0];
+        std::move(rightInner->keys + 1, rightInner->keys + rightInner->count - 1, rightInner->keys);
+        std::copy(rightInner->children + 1, rightInner->children + rightInner->count, rightInner->children);
+        std::copy(rightInner->sizes + 1, rightInner->sizes + rightInner->count, rightInner->sizes);
+        rightInner->count--;
+    }
+    inner->sizes[index] = subtreeSize(child);
+    inner->sizes[index + 1] = subtreeSize(right);
+}
+
+// folds children[index + 1] into children[index] and drops it from inner
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::mergeChildren(Inner* inner, int index) {
+    MAP_STAT(merges++;)
+    Node* left = inner->children[index];
+    Node* right = inner->children[index + 1];
+    if (left->isLeaf) {
+        Leaf* leftLeaf = static_cast<Leaf*>(left);
+        Leaf* rightLeaf = static_cast<Leaf*>(right);
+        std::move(rightLeaf->keys, rightLeaf->keys + rightLeaf->count, leftLeaf->keys + leftLeaf->count);
+        std::move(rightLeaf->values, rightLeaf->values + rightLeaf->count, leftLeaf->values + leftLeaf->count);
+        leftLeaf->count += rightLeaf->count;
+        leftLeaf->next = rightLeaf->next;
+        leafPool.destroy(rightLeaf);
+    }
+    else {
+        // the parent's separator comes down between the two halves
+        Inner* leftInner = static_cast<Inner*>(left);
+        Inner* rightInner = static_cast<Inner*>(right);
+        leftInner->keys[leftInner->count - 1] = inner->keys[index];
+        std::move(rightInner->keys, rightInner->keys + rightInner->count - 1, leftInner->keys + leftInner->count);
+        std::copy(rightInner->children, rightInner->children + rightInner->count, leftInner->children + leftInner->count);
+        std::copy(rightInner->sizes, rightInner->sizes + rightInner->count, leftInner->sizes + leftInner->count);
+        leftInner->count += rightInner->count;
+        innerPool.destroy(rightInner);
+    }
+    std::move(inner->keys + index + 1, inner->keys + inner->count - 1, inner->keys + index);
+    std::copy(inner->children + index + 2, inner->children + inner->count, inner->children + index + 1);
+    std::copy(inner->sizes + index + 2, inner->sizes + inner->count, inner->sizes + index + 1);
+    inner->count--;
+    inner->sizes[index] = subtreeSize(left);
+}
+
+// helper function for finding the leaf and slot holding key. returns NULL if it is not found
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::helperSearchID(const Key& key, int& position) const {
+    Node* node = this->root;
+    if (node == nullptr)
+        return nullptr;
+    while (!node->isLeaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[childIndex(inner, key)];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    position = leafPosition(leaf, key);
+    if (position == leaf->count || compare(key, leaf->keys[position]))
+        return nullptr;
+    return leaf;
+}
+
+// helper function for running the destructor of every node in the tree
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::helperDestroy(Node* node) {
+    if (node == nullptr)
+        return;
+    if (node->isLeaf) {
+        static_cast<Leaf*>(node)->~Leaf();
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (int i = 0; i < inner->count; i++)
+        helperDestroy(inner->children[i]);
+    inner->~Inner(); // memory is returned in bulk by the pools' clear()
+}
+
+// function used to find the left-most leaf
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::firstLeaf() const {
+    Node* node = this->root;
+    if (node == nullptr)
+        return nullptr;
+    while (!node->isLeaf)
+        node = static_cast<Inner*>(node)->children[0];
+    return static_cast<Leaf*>(node);
+}
+
+template <typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::~BPlusTree() {
+    clear();
+}
+
+// public function that removes every entry, handing node memory back a whole block at a time
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::clear() {
+    helperDestroy(this->root);
+    leafPool.clear();
+    innerPool.clear();
+    nameIndex.clear();
+    this->root = nullptr;
+    entryCount = 0;
+}
+
+// public function that calls helper function helperInsert(). returns false if key is already in the tree
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::insert(const Key& key, const Value& value) {
+    return !helperInsert(key, false, value);
+}
+
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::insert(const Key& key, Value&& value) {
+    return !helperInsert(key, false, std::move(value));
+}
+
+// public function that inserts key with a value constructed from args, like AVL::emplace()
+template <typename Key, typename Value, typename Compare>
+template <typename... Args>
+bool BPlusTree<Key, Value, Compare>::emplace(const Key& key, Args&&... args) {
+    return !helperInsert(key, false, std::forward<Args>(args)...);
+}
+
+// public function that inserts key, or replaces its value if it already exists.
+// returns true if key already existed
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::upsert(const Key& key, const Value& value) {
+    return helperInsert(key, true, value);
+}
+
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::upsert(const Key& key, Value&& value) {
+    return helperInsert(key, true, std::move(value));
+}
+
+// public function that calls helper function helperRemove(), then shrinks the tree by one
+// level if the root was left with a single child
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::remove(const Key& key) {
+    if (this->root == nullptr || !helperRemove(this->root, key))
+        return false;
+    if (this->root->isLeaf) {
+        if (this->root->count == 0) {
+            leafPool.destroy(static_cast<Leaf*>(this->root));
+            this->root = nullptr;
+        }
+    }
+    else if (this->root->count == 1) {
+        Inner* oldRoot = static_cast<Inner*>(this->root);
+        this->root = oldRoot->children[0];
+        innerPool.destroy(oldRoot);
+    }
+    return true;
+}
+
+// public function that calls helper function helperSearchID(). returns NULL if key is not in the tree
+template <typename Key, typename Value, typename Compare>
+const Value* BPlusTree<Key, Value, Compare>::search(const Key& key) const {
+    int position = 0;
+    Leaf* leaf = helperSearchID(key, position);
+    if (leaf == nullptr) // no such key exists in the tree
+        return nullptr;
+    return &leaf->values[position];
+}
+
+// public function that returns every key whose value is value in ascending order.
+// O(1 + k) with the name index enabled, otherwise a scan over the leaves
+template <typename Key, typename Value, typename Compare>
+std::vector<Key> BPlusTree<Key, Value, Compare>::keysWithValue(const Value& value) {
+    if (nameIndex.isEnabled())
+        return nameIndex.find(value);
+    std::vector<Key> keys;
+    visitInorder([&](const Key& key, const Value& entryValue) {
+        if (entryValue == value)
+            keys.push_back(key);
+    });
+    return keys;
+}
+
+// public function that turns the name index on (building it from the current tree) or off (freeing it)
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::enableNameIndex(bool enable) {
+    nameIndex.setEnabled(enable);
+    if (enable)
+        visitInorder([&](const Key& key, const Value& value) { nameIndex.add(value, key); });
+}
+
+// a B+ tree keeps its entries only in the leaves, so it has no meaningful pre-order.
+// these list every value in key order, separated by commas, to match AVL::preorderPrint()'s format.
+// like AVL's print functions they only compile for string values
+template <typename Key, typename Value, typename Compare>
+string BPlusTree<Key, Value, Compare>::preorderPrint() {
+    string traverse;
+    bool first = true;
+    visitInorder([&](const Key&, const Value& name) {
+        if (!first)
+            traverse += ", ";
+        traverse += name;
+        first = false;
+    });
+    return traverse;
+}
+
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::preorderPrint(std::ostream& out) {
+    OutputSink sink(out);
+    bool first = true;
+    visitInorder([&](const Key&, const Value& name) {
+        if (!first)
+            sink.write(", ", 2);
+        sink.write(name);
+        first = false;
+    });
+}
+
+// public function that calls visit(key, value) for every entry in key order by walking the leaf chain
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void BPlusTree<Key, Value, Compare>::visitInorder(Visitor visit) {
+    for (Leaf* leaf = firstLeaf(); leaf != nullptr; leaf = leaf->next) {
+        for (int i = 0; i < leaf->count; i++)
+            visit(leaf->keys[i], leaf->values[i]);
+    }
+}
+
+// public function that stores the key at 0-based position index into key, or returns false if there is none
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::select(unsigned int index, Key& key) const {
+    if (index >= entryCount)
+        return false;
+    Node* node = this->root;
+    while (!node->isLeaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int i = 0;
+        while (index >= inner->sizes[i]) { // skip whole children until the position is inside one
+            index -= inner->sizes[i];
+            i++;
+        }
+        node = inner->children[i];
+    }
+    key = static_cast<Leaf*>(node)->keys[index];
+    return true;
+}
+
+// public function that returns how many keys in the tree are smaller than key
+template <typename Key, typename Value, typename Compare>
+unsigned int BPlusTree<Key, Value, Compare>::rank(const Key& key) const {
+    unsigned int count = 0;
+    Node* node = this->root;
+    if (node == nullptr)
+        return 0;
+    while (!node->isLeaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int index = childIndex(inner, key);
+        for (int i = 0; i < index; i++)
+            count += inner->sizes[i];
+        node = inner->children[index];
+    }
+    return count + leafPosition(static_cast<Leaf*>(node), key);
+}
+
+// public function that removes the entry at 0-based position index
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::removeNth(unsigned int index) {
+    Key key{};
+    if (!select(index, key))
+        return false;
+    return remove(key);
+}
+
+template <typename Key, typename Value, typename Compare>
+unsigned int BPlusTree<Key, Value, Compare>::getNodeCount() const {
+    return entryCount;
+}
+
+// fills in the tree's part of a TreeStats: its shape, and in MAP_STATS builds the split, merge and
+// borrow counts. every entry sits in a leaf, so every search visits one node per level
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::stats(TreeStats& result) const {
+    MAP_STAT(result.splits = splits; result.merges = merges; result.borrows = borrows;)
+    int levels = 0;
+    for (const Node* node = this->root; node != nullptr; levels++)
+        node = node->isLeaf ? nullptr : static_cast<const Inner*>(node)->children[0];
+    result.entries = entryCount;
+    result.height = entryCount > 0 ? levels : 0;
+    result.averageDepth = result.height;
+}
+
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::resetStats() {
+    MAP_STAT(splits = merges = borrows = 0;)
+}
+
+// memory held by the tree. every slot of a node holds a key (and, in a leaf, a value) whether it
+// is in use or not, so all of them are counted, and node memory itself comes from the two pools
+template <typename Key, typename Value, typename Compare>
+MemoryUsage BPlusTree<Key, Value, Compare>::memoryUsage() const {
+    MemoryUsage usage;
+    usage.nodes = leafPool.liveBytes() + innerPool.liveBytes();
+    usage.freeNodes = leafPool.bytes() + innerPool.bytes() - usage.nodes;
+    usage.index = nameIndex.memoryUsage();
+    usage.other = sizeof(*this);
+    helperHeapBytes(this->root, usage);
+    return usage;
+}
+
+// adds the heap buffers owned by the keys and values under node
+template <typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::helperHeapBytes(const Node* node, MemoryUsage& usage) {
+    if (node == nullptr)
+        return;
+    if (node->isLeaf) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        for (int i = 0; i < LEAF_CAPACITY; i++) {
+            usage.keys += heapBytes(leaf->keys[i]);
+            usage.values += heapBytes(leaf->values[i]);
+        }
+        return;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    for (int i = 0; i < INNER_CAPACITY - 1; i++)
+        usage.keys += heapBytes(inner->keys[i]);
+    for (int i = 0; i < inner->count; i++)
+        helperHeapBytes(inner->children[i], usage);
+}
+
+// public function that loads many (key, value) records at once, with the same rules as AVL::bulkLoad().
+// once the records are sorted the tree is built bottom-up in O(n): leaves are filled evenly from the
+// sorted records, then each level of inner nodes is built over the one below it
+template <typename Key, typename Value, typename Compare>
+unsigned int BPlusTree<Key, Value, Compare>::bulkLoad(std::vector<std::pair<Key, Value>> records) {
+    using Record = std::pair<Key, Value>;
+    auto byKey = [this](const Record& a, const Record& b) { return compare(a.first, b.first); };
+    if (!std::is_sorted(records.begin(), records.end(), byKey))
+        std::stable_sort(records.begin(), records.end(), byKey); // stable, so the first of any duplicates stays first
+    auto sameKey = [this](const Record& a, const Record& b) { return !compare(a.first, b.first); }; // a <= b once sorted
+    records.erase(std::unique(records.begin(), records.end(), sameKey), records.end());
+
+    unsigned int previousCount = entryCount;
+    if (this->root != nullptr) {
+        // merge with what is already in the tree. existing entries are listed first so they win ties
+        std::vector<Record> current;
+        current.reserve(entryCount);
+        visitInorder([&](Key& key, Value& value) { current.emplace_back(std::move(key), std::move(value)); });
+        std::vector<Record> merged;
+        merged.reserve(current.size() + records.size());
+        std::merge(std::make_move_iterator(current.begin()), std::make_move_iterator(current.end()),
+            std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()),
+            std::back_inserter(merged), byKey);
+        merged.erase(std::unique(merged.begin(), merged.end(), sameKey), merged.end());
+        records.swap(merged);
+    }
+
+    clear();
+    if (records.empty())
+        return 0;
+
+    // spreading entries evenly keeps every node at least half full whenever there is more than one
+    std::vector<Node*> level;
+    std::vector<Key> lowestKeys; // smallest key under each node of the current level
+    size_t total = records.size();
+    size_t leafCount = (total + LEAF_CAPACITY - 1) / LEAF_CAPACITY;
+    size_t next = 0;
+    Leaf* previous = nullptr;
+    for (size_t i = 0; i < leafCount; i++) {
+        Leaf* leaf = leafPool.create();
+        size_t take = total / leafCount + (i < total % leafCount ? 1 : 0);
+        for (size_t j = 0; j < take; j++, next++) {
+            nameIndex.add(records[next].second, records[next].first);
+            leaf->keys[j] = std::move(records[next].first);
+            leaf->values[j] = std::move(records[next].second);
+        }
+        leaf->count = (int)take;
+        if (previous != nullptr)
+            previous->next = leaf;
+        previous = leaf;
+        level.push_back(leaf);
+        lowestKeys.push_back(leaf->keys[0]);
+    }
+
+    while (level.size() > 1) {
+        std::vector<Node*> parents;
+        std::vector<Key> parentKeys;
+        size_t parentCount = (level.size() + INNER_CAPACITY - 1) / INNER_CAPACITY;
+        size_t child = 0;
+        for (size_t i = 0; i < parentCount; i++) {
+            Inner* inner = innerPool.create();
+            size_t take = level.size() / parentCount + (i < level.size() % parentCount ? 1 : 0);
+            parentKeys.push_back(lowestKeys[child]);
+            for (size_t j = 0; j < take; j++, child++) {
+                inner->children[j] = level[child];
+                inner->sizes[j] = subtreeSize(level[child]);
+                if (j > 0)
+                    inner->keys[j - 1] = lowestKeys[child];
+            }
+            inner->count = (int)take;
+            parents.push_back(inner);
+        }
+        level.swap(parents);
+        lowestKeys.swap(parentKeys);
+    }
+    this->root = level[0];
+    entryCount = (unsigned int)total;
+    return entryCount - previousCount;
+}
+
+// returns a cursor at the smallest key in the tree
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Iterator BPlusTree<Key, Value, Compare>::begin() const {
+    Iterator iter;
+    iter.leaf = firstLeaf();
+    return iter;
+}
+
+// returns the past-the-end cursor
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Iterator BPlusTree<Key, Value, Compare>::end() const {
+    return Iterator();
+}
+
+// returns a cursor at the first key that is not less than key. O(log n)
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Iterator BPlusTree<Key, Value, Compare>::lowerBound(const Key& key) const {
+    Iterator iter;
+    Node* node = this->root;
+    if (node == nullptr)
+        return iter;
+    while (!node->isLeaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[childIndex(inner, key)];
+    }
+    iter.leaf = static_cast<Leaf*>(node);
+    iter.position = leafPosition(iter.leaf, key);
+    if (iter.position == iter.leaf->count) { // every key in this leaf is smaller, so the answer starts the next one
+        iter.leaf = iter.leaf->next;
+        iter.position = 0;
+    }
+    return iter;
+}
+
+// returns a cursor at the first key that is greater than key
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Iterator BPlusTree<Key, Value, Compare>::upperBound(const Key& key) const {
+    Iterator iter = lowerBound(key);
+    if (iter.leaf != nullptr && !compare(key, iter.key()))
+        ++iter;
+    return iter;
+}
+
+// the comparator the tree orders its keys with
+template <typename Key, typename Value, typename Compare>
+const Compare& BPlusTree<Key, Value, Compare>::keyCompare() const {
+    return compare;
+}
+
+// moves to the next key in ascending order, stepping into the next leaf at the end of this one
+template <typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Iterator& BPlusTree<Key, Value, Compare>::Iterator::operator++() {
+    position++;
+    if (position == leaf->count) {
+        leaf = leaf->next;
+        position = 0;
+    }
+    return *this;
+}
+
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::Iterator::operator!=(Iterator const& rhs) const {
+    return !(*this == rhs);
+}
+
+template <typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::Iterator::operator==(Iterator const& rhs) const {
+    return leaf == rhs.leaf && position == rhs.position;
+}
+
+template <typename Key, typename Value, typename Compare>
+std::pair<const Key&, const Value&> BPlusTree<Key, Value, Compare>::Iterator::operator*() const {
+    return std::pair<const Key&, const Value&>(key(), value());
+}
+
+template <typename Key, typename Value, typename Compare>
+const Key& BPlusTree<Key, Value, Compare>::Iterator::key() const {
+    return leaf->keys[position];
+}
+
+template <typename Key, typename Value, typename Compare>
+const Value& BPlusTree<Key, Value, Compare>::Iterator::value() const {
+    return leaf->values[position];
+}
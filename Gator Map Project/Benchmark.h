@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timing harness for test.cpp. Each case runs a few untimed warmup rounds, then a number of timed
+// trials, and setup() runs before every round outside the timed region so no trial sees another's
+// leftovers. Operations are timed in blocks of blockOps: each block gives one latency sample (its
+// average time per operation), which is cheap enough not to disturb the operations themselves and
+// still fine grained enough to show slow stretches. The min, median and p99 are over those block
+// averages, so the p99 is of 1000-operation blocks, not the tail latency of single operations.
+struct BenchmarkOptions {
+	unsigned int seed = 3503;	// every key set is drawn from this, so runs are repeatable
+	int warmup = 1;
+	int trials = 5;
+	size_t blockOps = 1000;
+};
+
+struct BenchmarkResult {
+	std::string operation;
+	std::string backend;
+	size_t size;	// entries in the map
+	size_t ops;	// operations per trial
+	int trials;
+	double minNs;	// per operation, over the block averages
+	double medianNs;
+	double p99BlockNs;	// 99th percentile block average, not a per-operation tail
+	double opsPerSecond;	// of the median trial
+};
+
+class Benchmark {
+private:
+	using Clock = std::chrono::steady_clock;
+
+	BenchmarkOptions options;
+	std::vector<BenchmarkResult> results;
+	volatile size_t sink = 0;	// results of the timed operations end up here so they can't be optimized away
+
+	void record(const std::string& operation, const std::string& backend, size_t size, size_t ops,
+		std::vector<double>& samples, std::vector<double>& trialNs);
+	static double percentile(const std::vector<double>& sorted, double fraction);
+	static std::string escapeCsv(const std::string& text);
+	static std::string escapeJson(const std::string& text);
+
+public:
+	explicit Benchmark(const BenchmarkOptions& options);
+
+	const BenchmarkOptions& settings() const;
+	// Times body(first, last), which performs operations [first, last) and returns something that
+	// depends on their results, over ops operations per trial
+	template <typename Setup, typename Body>
+	void run(const std::string& operation, const std::string& backend, size_t size, size_t ops, Setup setup, Body body);
+	// For operations that can't be split into blocks, such as a traversal or a multithreaded run:
+	// body() performs all ops at once and each trial gives one sample
+	template <typename Setup, typename Body>
+	void runWhole(const std::string& operation, const std::string& backend, size_t size, size_t ops, Setup setup, Body body);
+
+	const std::vector<BenchmarkResult>& all() const;
+	void writeTable(std::ostream& out) const;
+	void writeCsv(std::ostream& out) const;
+	void writeJson(std::ostream& out) const;
+};
+
+inline Benchmark::Benchmark(const BenchmarkOptions& options) : options(options) {
+}
+
+inline const BenchmarkOptions& Benchmark::settings() const {
+	return options;
+}
+
+template <typename Setup, typename Body>
+void Benchmark::run(const std::string& operation, const std::string& backend, size_t size, size_t ops, Setup setup, Body body) {
+	std::vector<double> samples;
+	std::vector<double> trialNs;
+	for (int round = 0; round < options.warmup + options.trials; round++) {
+		setup();
+		double total = 0;
+		for (size_t first = 0; first < ops; first += options.blockOps) {
+			size_t last = std::min(ops, first + options.blockOps);
+			auto start = Clock::now();
+			sink = sink + (size_t)body(first, last);
+			auto stop = Clock::now();
+			double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+			total += ns;
+			if (round >= options.warmup)
+				samples.push_back(ns / (double)(last - first));
+		}
+		if (round >= options.warmup)
+			trialNs.push_back(total);
+	}
+	record(operation, backend, size, ops, samples, trialNs);
+}
+
+template <typename Setup, typename Body>
+void Benchmark::runWhole(const std::string& operation, const std::string& backend, size_t size, size_t ops, Setup setup, Body body) {
+	std::vector<double> samples;
+	std::vector<double> trialNs;
+	for (int round = 0; round < options.warmup + options.trials; round++) {
+		setup();
+		auto start = Clock::now();
+		sink = sink + (size_t)body();
+		auto stop = Clock::now();
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+		if (round >= options.warmup) {
+			samples.push_back(ns / (double)std::max<size_t>(ops, 1));
+			trialNs.push_back(ns);
+		}
+	}
+	record(operation, backend, size, ops, samples, trialNs);
+}
+
+inline void Benchmark::record(const std::string& operation, const std::string& backend, size_t size, size_t ops,
+	std::vector<double>& samples, std::vector<double>& trialNs) {
+	std::sort(samples.begin(), samples.end());
+	std::sort(trialNs.begin(), trialNs.end());
+	BenchmarkResult result;
+	result.operation = operation;
+	result.backend = backend;
+	result.size = size;
+	result.ops = ops;
+	result.trials = options.trials;
+	result.minNs = samples.empty() ? 0 : samples.front();
+	result.medianNs = percentile(samples, 0.5);
+	result.p99BlockNs = percentile(samples, 0.99);
+	double medianTrial = percentile(trialNs, 0.5);
+	result.opsPerSecond = medianTrial > 0 ? (double)ops * 1e9 / medianTrial : 0;
+	results.push_back(result);
+
+	// progress, since a full run takes a while
+	std::fprintf(stderr, "%-24s %-32s %9zu  median %10.1f ns/op\n", operation.c_str(), backend.c_str(), size, result.medianNs);
+}
+
+// Nearest rank percentile of an already sorted list
+inline double Benchmark::percentile(const std::vector<double>& sorted, double fraction) {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (size_t)(fraction * (double)sorted.size() + 0.999999);
+	rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+	return sorted[rank - 1];
+}
+
+// CSV fields are quoted, with quotes inside them doubled
+inline std::string Benchmark::escapeCsv(const std::string& text) {
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"')
+			escaped += '"';
+		escaped += c;
+	}
+	return escaped;
+}
+
+inline std::string Benchmark::escapeJson(const std::string& text) {
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+inline const std::vector<BenchmarkResult>& Benchmark::all() const {
+	return results;
+}
+
+inline void Benchmark::writeTable(std::ostream& out) const {
+	out << std::left << std::setw(24) << "operation" << std::setw(32) << "backend" << std::right
+		<< std::setw(10) << "size" << std::setw(12) << "min ns/op" << std::setw(12) << "median" << std::setw(12) << "p99 block"
+		<< std::setw(14) << "Mops/s" << "\n";
+	out << std::fixed << std::setprecision(1);
+	for (const BenchmarkResult& result : results) {
+		out << std::left << std::setw(24) << result.operation << std::setw(32) << result.backend << std::right
+			<< std::setw(10) << result.size << std::setw(12) << result.minNs << std::setw(12) << result.medianNs
+			<< std::setw(12) << result.p99BlockNs << std::setw(14) << std::setprecision(3) << result.opsPerSecond / 1e6
+			<< std::setprecision(1) << "\n";
+	}
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+}
+
+inline void Benchmark::writeCsv(std::ostream& out) const {
+	out << "operation,backend,size,ops,trials,min_ns,median_ns,p99_block_ns,ops_per_second\n";
+	for (const BenchmarkResult& result : results) {
+		out << '"' << escapeCsv(result.operation) << "\",\"" << escapeCsv(result.backend) << "\","
+			<< result.size << ',' << result.ops << ',' << result.trials << ',' << result.minNs << ','
+			<< result.medianNs << ',' << result.p99BlockNs << ',' << result.opsPerSecond << "\n";
+	}
+}
+
+inline void Benchmark::writeJson(std::ostream& out) const {
+	out << "{\n  \"seed\": " << options.seed << ",\n  \"warmup\": " << options.warmup << ",\n  \"trials\": "
+		<< options.trials << ",\n  \"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& result = results[i];
+		out << (i == 0 ? "\n" : ",\n") << "    { \"operation\": \"" << escapeJson(result.operation)
+			<< "\", \"backend\": \"" << escapeJson(result.backend) << "\", \"size\": " << result.size
+			<< ", \"ops\": " << result.ops << ", \"trials\": " << result.trials << ", \"min_ns\": " << result.minNs
+			<< ", \"median_ns\": " << result.medianNs << ", \"p99_block_ns\": " << result.p99BlockNs
+			<< ", \"ops_per_second\": " << result.opsPerSecond << " }";
+	}
+	out << "\n  ]\n}\n";
+}
@@ -0,0 +1,486 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Epoch.h"
+using std::string;
+
+// Thread-safe ordered map with the same string ID interface as OrderedMap, for many readers and one
+// writer at a time.
+//
+// The tree is an AVL whose nodes are never changed once they are reachable. A write copies the nodes
+// on the path from the root down to the change (rotations included), links the copies to the untouched
+// sub-trees, and then publishes the new root with a single atomic store (path copying, RCU style).
+// Readers take no lock: they load the root and see one consistent version of the whole map for as long
+// as they hold on to it, however many writes happen meanwhile. Replaced nodes are freed through an
+// EpochDomain once no reader can still reach them. Writers are serialized by one mutex.
+//
+// snapshot() pins a version so it can be iterated and range-scanned at leisure. Memory retired while a
+// snapshot is alive is only freed after it goes away, so snapshots should not be kept indefinitely.
+class ConcurrentOrderedMap {
+private:
+    struct TreeNode {
+        const string name;
+        const int id;
+        const int height;
+        const unsigned int size;
+        const TreeNode* const left;
+        const TreeNode* const right;
+        TreeNode(const string& studentName, int studentID, const TreeNode* leftPtr, const TreeNode* rightPtr);
+    };
+
+    // an AVL holding every possible int ID is at most ~46 levels tall
+    static const int MAX_HEIGHT = 64;
+    static const size_t RECLAIM_BATCH = 256; // retired nodes collected before trying to free them
+
+    std::atomic<const TreeNode*> root{ nullptr };
+    mutable EpochDomain epochs;
+
+    // writer side
+    std::mutex writeLock;
+    std::vector<std::pair<const TreeNode*, uint64_t>> retired;
+
+    static int height(const TreeNode* node);
+    static unsigned int subtreeSize(const TreeNode* node);
+    static const TreeNode* balanced(const string& name, int id, const TreeNode* left, const TreeNode* right,
+        std::vector<const TreeNode*>& replaced);
+    static const TreeNode* helperInsert(const TreeNode* node, const string& name, int id, bool overwrite,
+        bool& existed, std::vector<const TreeNode*>& replaced);
+    static const TreeNode* helperRemove(const TreeNode* node, int id, bool& found, std::vector<const TreeNode*>& replaced);
+    static const TreeNode* helperRemoveMin(const TreeNode* node, std::vector<const TreeNode*>& replaced);
+    static const TreeNode* helperSearchID(const TreeNode* node, int id);
+    template <typename Visitor>
+    static void helperInorder(const TreeNode* node, Visitor& visit);
+    void publish(const TreeNode* newRoot, std::vector<const TreeNode*>& replaced);
+
+public:
+    class Iterator;
+    class Snapshot;
+
+    ConcurrentOrderedMap() = default;
+    ~ConcurrentOrderedMap();
+    ConcurrentOrderedMap(const ConcurrentOrderedMap&) = delete;
+    ConcurrentOrderedMap& operator=(const ConcurrentOrderedMap&) = delete;
+
+    // writers, one at a time
+    bool insert(const string& ID, const string& NAME);
+    bool upsert(const string& ID, const string& NAME);
+    bool remove(const string& ID);
+
+    // lock-free readers, each working on the latest version when it starts
+    string search(const string& ID) const;
+    string select(unsigned int index) const;
+    unsigned int rank(const string& ID) const;
+    unsigned int size() const;
+    template <typename Visitor>
+    void forEach(Visitor visit) const;
+    Snapshot snapshot() const;
+
+    // in-order cursor over one version of the tree, like AVL::Iterator
+    class Iterator {
+    private:
+        const TreeNode* stack[MAX_HEIGHT];
+        int depth = 0;
+        void pushLeft(const TreeNode* node);
+
+    public:
+        Iterator& operator++();
+        bool operator!=(Iterator const& rhs) const;
+        bool operator==(Iterator const& rhs) const;
+        std::pair<int, const string&> operator*() const;
+        int id() const;
+        const string& name() const;
+        friend class ConcurrentOrderedMap;
+    };
+
+    // A version of the map pinned for as long as the snapshot exists. Its iterators stay valid, and
+    // keep seeing exactly that version, while writers carry on. Must not outlive the map.
+    class Snapshot {
+    private:
+        EpochDomain::Guard guard;
+        const TreeNode* root;
+
+    public:
+        explicit Snapshot(const ConcurrentOrderedMap& map);
+
+        // a pair of iterators that can be used in a range-based for loop
+        struct Range {
+            Iterator first;
+            Iterator last;
+            Iterator begin() const { return first; }
+            Iterator end() const { return last; }
+        };
+
+        unsigned int size() const;
+        Iterator begin() const;
+        Iterator end() const;
+        Iterator lower_bound(const string& ID) const;
+        Iterator upper_bound(const string& ID) const;
+        Range range(const string& LO, const string& HI) const;
+    };
+};
+
+inline ConcurrentOrderedMap::TreeNode::TreeNode(const string& studentName, int studentID, const TreeNode* leftPtr, const TreeNode* rightPtr)
+    : name(studentName), id(studentID),
+      height(std::max(ConcurrentOrderedMap::height(leftPtr), ConcurrentOrderedMap::height(rightPtr)) + 1),
+      size(subtreeSize(leftPtr) + subtreeSize(rightPtr) + 1), left(leftPtr), right(rightPtr) {
+}
+
+// assumes no other thread is still using the map, so every node can go at once
+inline ConcurrentOrderedMap::~ConcurrentOrderedMap() {
+    std::vector<const TreeNode*> pending;
+    if (root.load() != nullptr)
+        pending.push_back(root.load());
+    while (!pending.empty()) {
+        const TreeNode* node = pending.back();
+        pending.pop_back();
+        if (node->left != nullptr)
+            pending.push_back(node->left);
+        if (node->right != nullptr)
+            pending.push_back(node->right);
+        delete node;
+    }
+    for (auto& entry : retired)
+        delete entry.first;
+}
+
+inline int ConcurrentOrderedMap::height(const TreeNode* node) {
+    return node == nullptr ? 0 : node->height;
+}
+
+inline unsigned int ConcurrentOrderedMap::subtreeSize(const TreeNode* node) {
+    return node == nullptr ? 0 : node->size;
+}
+
+// builds a new node over left and right, applying whichever rotation restores the AVL property.
+// a rotation rebuilds the child it lifts rather than changing it, so that child is added to replaced
+inline const ConcurrentOrderedMap::TreeNode* ConcurrentOrderedMap::balanced(const string& name, int id,
+    const TreeNode* left, const TreeNode* right, std::vector<const TreeNode*>& replaced) {
+    int balanceValue = height(left) - height(right);
+
+    if (balanceValue > 1) {
+        // left left
+        if (height(left->left) >= height(left->right)) {
+            replaced.push_back(left);
+            return new TreeNode(left->name, left->id, left->left, new TreeNode(name, id, left->right, right));
+        }
+        // left right
+        const TreeNode* pivot = left->right;
+        replaced.push_back(left);
+        replaced.push_back(pivot);
+        return new TreeNode(pivot->name, pivot->id,
+            new TreeNode(left->name, left->id, left->left, pivot->left),
+            new TreeNode(name, id, pivot->right, right));
+    }
+
+    if (balanceValue < -1) {
+        // right right
+        if (height(right->right) >= height(right->left)) {
+            replaced.push_back(right);
+            return new TreeNode(right->name, right->id, new TreeNode(name, id, left, right->left), right->right);
+        }
+        // right left
+        const TreeNode* pivot = right->left;
+        replaced.push_back(right);
+        replaced.push_back(pivot);
+        return new TreeNode(pivot->name, pivot->id,
+            new TreeNode(name, id, left, pivot->left),
+            new TreeNode(right->name, right->id, pivot->right, right->right));
+    }
+
+    return new TreeNode(name, id, left, right);
+}
+
+// returns the root of the new version of node's sub-tree. every node that the new version no
+// longer uses is added to replaced. existed is set if id was already present
+inline const ConcurrentOrderedMap::TreeNode* ConcurrentOrderedMap::helperInsert(const TreeNode* node,
+    const string& name, int id, bool overwrite, bool& existed, std::vector<const TreeNode*>& replaced) {
+    if (node == nullptr)
+        return new TreeNode(name, id, nullptr, nullptr);
+    if (id == node->id) {
+        existed = true;
+        if (!overwrite)
+            return node;
+        replaced.push_back(node);
+        return new TreeNode(name, id, node->left, node->right);
+    }
+    if (id < node->id) {
+        const TreeNode* left = helperInsert(node->left, name, id, overwrite, existed, replaced);
+        if (left == node->left) // nothing changed below, so this sub-tree can be shared as it is
+            return node;
+        replaced.push_back(node);
+        return balanced(node->name, node->id, left, node->right, replaced);
+    }
+    const TreeNode* right = helperInsert(node->right, name, id, overwrite, existed, replaced);
+    if (right == node->right)
+        return node;
+    replaced.push_back(node);
+    return balanced(node->name, node->id, node->left, right, replaced);
+}
+
+inline const ConcurrentOrderedMap::TreeNode* ConcurrentOrderedMap::helperRemove(const TreeNode* node, int id,
+    bool& found, std::vector<const TreeNode*>& replaced) {
+    if (node == nullptr)
+        return nullptr;
+    if (id < node->id) {
+        const TreeNode* left = helperRemove(node->left, id, found, replaced);
+        if (!found)
+            return node;
+        replaced.push_back(node);
+        return balanced(node->name, node->id, left, node->right, replaced);
+    }
+    if (id > node->id) {
+        const TreeNode* right = helperRemove(node->right, id, found, replaced);
+        if (!found)
+            return node;
+        replaced.push_back(node);
+        return balanced(node->name, node->id, node->left, right, replaced);
+    }
+
+    found = true;
+    replaced.push_back(node);
+    // no child and one child case: the child (or NULL) takes the removed node's place
+    if (node->left == nullptr)
+        return node->right;
+    if (node->right == nullptr)
+        return node->left;
+    // two child case: the in-order successor takes its place. the successor is only retired,
+    // not freed, so it can still be read after helperRemoveMin
+    const TreeNode* successor = node->right;
+    while (successor->left != nullptr)
+        successor = successor->left;
+    const TreeNode* right = helperRemoveMin(node->right, replaced);
+    return balanced(successor->name, successor->id, node->left, right, replaced);
+}
+
+// new version of node's sub-tree without its smallest node
+inline const ConcurrentOrderedMap::TreeNode* ConcurrentOrderedMap::helperRemoveMin(const TreeNode* node,
+    std::vector<const TreeNode*>& replaced) {
+    replaced.push_back(node);
+    if (node->left == nullptr)
+        return node->right;
+    return balanced(node->name, node->id, helperRemoveMin(node->left, replaced), node->right, replaced);
+}
+
+inline const ConcurrentOrderedMap::TreeNode* ConcurrentOrderedMap::helperSearchID(const TreeNode* node, int id) {
+    while (node != nullptr && node->id != id) {
+        if (id < node->id)
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return node;
+}
+
+template <typename Visitor>
+void ConcurrentOrderedMap::helperInorder(const TreeNode* node, Visitor& visit) {
+    if (node == nullptr)
+        return;
+    helperInorder(node->left, visit);
+    visit(node->id, node->name);
+    helperInorder(node->right, visit);
+}
+
+// called with writeLock held. makes newRoot the version readers see and retires the nodes it replaced
+inline void ConcurrentOrderedMap::publish(const TreeNode* newRoot, std::vector<const TreeNode*>& replaced) {
+    root.store(newRoot, std::memory_order_release);
+    if (replaced.empty())
+        return;
+    uint64_t retiredAt = epochs.retireEpoch();
+    for (const TreeNode* node : replaced)
+        retired.emplace_back(node, retiredAt);
+    if (retired.size() >= RECLAIM_BATCH)
+        epochs.reclaim(retired);
+}
+
+// returns false if ID is already in the map
+inline bool ConcurrentOrderedMap::insert(const string& ID, const string& NAME) {
+    int id = stoi(ID);
+    std::lock_guard<std::mutex> guard(writeLock);
+    bool existed = false;
+    std::vector<const TreeNode*> replaced;
+    const TreeNode* oldRoot = root.load(std::memory_order_relaxed);
+    const TreeNode* newRoot = helperInsert(oldRoot, NAME, id, false, existed, replaced);
+    if (newRoot != oldRoot)
+        publish(newRoot, replaced);
+    return !existed;
+}
+
+// inserts ID, or replaces its name if it already exists. returns true if ID already existed
+inline bool ConcurrentOrderedMap::upsert(const string& ID, const string& NAME) {
+    int id = stoi(ID);
+    std::lock_guard<std::mutex> guard(writeLock);
+    bool existed = false;
+    std::vector<const TreeNode*> replaced;
+    publish(helperInsert(root.load(std::memory_order_relaxed), NAME, id, true, existed, replaced), replaced);
+    return existed;
+}
+
+inline bool ConcurrentOrderedMap::remove(const string& ID) {
+    int id = stoi(ID);
+    std::lock_guard<std::mutex> guard(writeLock);
+    bool found = false;
+    std::vector<const TreeNode*> replaced;
+    const TreeNode* newRoot = helperRemove(root.load(std::memory_order_relaxed), id, found, replaced);
+    if (found)
+        publish(newRoot, replaced);
+    return found;
+}
+
+// returns ID's name, or "" if it is not in the map
+inline string ConcurrentOrderedMap::search(const string& ID) const {
+    int id = stoi(ID);
+    EpochDomain::Guard guard(epochs);
+    const TreeNode* node = helperSearchID(root.load(std::memory_order_acquire), id);
+    if (node == nullptr)
+        return "";
+    return node->name;
+}
+
+// returns the ID at 0-based position index in sorted order, or "" if index is out of range
+inline string ConcurrentOrderedMap::select(unsigned int index) const {
+    EpochDomain::Guard guard(epochs);
+    const TreeNode* node = root.load(std::memory_order_acquire);
+    while (node != nullptr) {
+        unsigned int leftSize = subtreeSize(node->left);
+        if (index < leftSize)
+            node = node->left;
+        else if (index > leftSize) {
+            index -= leftSize + 1;
+            node = node->right;
+        }
+        else
+            return std::to_string(node->id);
+    }
+    return "";
+}
+
+// returns the number of IDs in the map that sort before ID
+inline unsigned int ConcurrentOrderedMap::rank(const string& ID) const {
+    int id = stoi(ID);
+    EpochDomain::Guard guard(epochs);
+    unsigned int before = 0;
+    const TreeNode* node = root.load(std::memory_order_acquire);
+    while (node != nullptr) {
+        if (id <= node->id)
+            node = node->left;
+        else {
+            before += subtreeSize(node->left) + 1;
+            node = node->right;
+        }
+    }
+    return before;
+}
+
+inline unsigned int ConcurrentOrderedMap::size() const {
+    EpochDomain::Guard guard(epochs);
+    return subtreeSize(root.load(std::memory_order_acquire));
+}
+
+// calls visit(id, name) for every entry of the current version in ID order. writes made while
+// it runs are not seen. visit may read the map but must not write to it
+template <typename Visitor>
+void ConcurrentOrderedMap::forEach(Visitor visit) const {
+    EpochDomain::Guard guard(epochs);
+    helperInorder(root.load(std::memory_order_acquire), visit);
+}
+
+inline ConcurrentOrderedMap::Snapshot ConcurrentOrderedMap::snapshot() const {
+    return Snapshot(*this);
+}
+
+inline ConcurrentOrderedMap::Snapshot::Snapshot(const ConcurrentOrderedMap& map)
+    : guard(map.epochs), root(map.root.load(std::memory_order_acquire)) {
+}
+
+inline unsigned int ConcurrentOrderedMap::Snapshot::size() const {
+    return subtreeSize(root);
+}
+
+inline ConcurrentOrderedMap::Iterator ConcurrentOrderedMap::Snapshot::begin() const {
+    Iterator iter;
+    iter.pushLeft(root);
+    return iter;
+}
+
+inline ConcurrentOrderedMap::Iterator ConcurrentOrderedMap::Snapshot::end() const {
+    return Iterator();
+}
+
+// first entry whose ID is not less than ID
+inline ConcurrentOrderedMap::Iterator ConcurrentOrderedMap::Snapshot::lower_bound(const string& ID) const {
+    int id = stoi(ID);
+    Iterator iter;
+    for (const TreeNode* node = root; node != nullptr; ) {
+        if (node->id >= id) {
+            iter.stack[iter.depth++] = node;
+            node = node->left;
+        }
+        else
+            node = node->right;
+    }
+    return iter;
+}
+
+// first entry whose ID is greater than ID
+inline ConcurrentOrderedMap::Iterator ConcurrentOrderedMap::Snapshot::upper_bound(const string& ID) const {
+    int id = stoi(ID);
+    Iterator iter;
+    for (const TreeNode* node = root; node != nullptr; ) {
+        if (node->id > id) {
+            iter.stack[iter.depth++] = node;
+            node = node->left;
+        }
+        else
+            node = node->right;
+    }
+    return iter;
+}
+
+// every entry with LO <= ID <= HI, in ascending order
+inline ConcurrentOrderedMap::Snapshot::Range ConcurrentOrderedMap::Snapshot::range(const string& LO, const string& HI) const {
+    Range result;
+    result.first = lower_bound(LO);
+    result.last = upper_bound(HI);
+    if (stoi(HI) < stoi(LO)) // an inverted range is empty rather than running to the end of the map
+        result.last = result.first;
+    return result;
+}
+
+inline void ConcurrentOrderedMap::Iterator::pushLeft(const TreeNode* node) {
+    while (node != nullptr) {
+        stack[depth++] = node;
+        node = node->left;
+    }
+}
+
+inline ConcurrentOrderedMap::Iterator& ConcurrentOrderedMap::Iterator::operator++() {
+    const TreeNode* current = stack[--depth];
+    pushLeft(current->right);
+    return *this;
+}
+
+inline bool ConcurrentOrderedMap::Iterator::operator!=(Iterator const& rhs) const {
+    return !(*this == rhs);
+}
+
+inline bool ConcurrentOrderedMap::Iterator::operator==(Iterator const& rhs) const {
+    const TreeNode* lhsNode = depth > 0 ? stack[depth - 1] : nullptr;
+    const TreeNode* rhsNode = rhs.depth > 0 ? rhs.stack[rhs.depth - 1] : nullptr;
+    return lhsNode == rhsNode;
+}
+
+inline std::pair<int, const string&> ConcurrentOrderedMap::Iterator::operator*() const {
+    return std::pair<int, const string&>(stack[depth - 1]->id, stack[depth - 1]->name);
+}
+
+inline int ConcurrentOrderedMap::Iterator::id() const {
+    return stack[depth - 1]->id;
+}
+
+inline const string& ConcurrentOrderedMap::Iterator::name() const {
+    return stack[depth - 1]->name;
+}
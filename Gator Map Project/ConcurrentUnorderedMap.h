@@ -0,0 +1,300 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Epoch.h"
+#include "Hash.h"
+using std::string;
+
+// Thread-safe hash map for many readers and a few writers, with the same chaining layout as
+// UnorderedMap.
+//
+// Writers lock one of STRIPES mutexes, picked by the low bits of the key's hash. Every table has at
+// least STRIPES buckets, so a bucket always belongs to exactly one stripe whatever the table size.
+// Readers take no lock at all: entries are never changed once they are in a chain (an update links
+// in a replacement entry), chain links are atomic, and unlinked entries are only freed once every
+// reader that could still be looking at them has finished (see EpochDomain).
+//
+// Growing is cooperative. The writer that pushes its stripe past the max load allocates a table twice
+// the size and publishes it; each stripe is then copied over by whichever writer locks it next, so no
+// operation ever waits on the whole table being moved. A stripe records which table holds its
+// entries, and readers follow that.
+//
+// Values are returned by copy, since a reference could outlive the entry it points into.
+class ConcurrentUnorderedMap {
+private:
+	static const unsigned int STRIPES = 256;
+	static const size_t RECLAIM_BATCH = 64;	// retired entries a stripe collects before trying to free them
+
+	struct Node {
+		std::atomic<Node*> next;
+		const uint64_t hashCode;
+		const string key;
+		const string value;
+		Node(Node* link, uint64_t hash, std::string_view k, string const& v);
+	};
+
+	struct Table {
+		unsigned int bucketCount;	// power of two, at least STRIPES
+		std::atomic<Node*>* buckets;
+		explicit Table(unsigned int count);
+		~Table();
+	};
+
+	struct alignas(64) Stripe {
+		std::mutex lock;
+		std::atomic<Table*> table{ nullptr };	// the table this stripe's entries are in
+		std::atomic<size_t> count{ 0 };	// written under lock, read without by size()
+		std::vector<std::pair<Node*, uint64_t>> retired;	// unlinked entries and the epoch they were unlinked in
+	};
+
+	mutable Stripe stripes[STRIPES];
+	EpochDomain epochs;
+	std::atomic<Table*> current{ nullptr };
+	double maxLoad;
+
+	// growth, one at a time
+	std::mutex resizeLock;
+	Table* previous = nullptr;	// table being migrated out of, if any
+	std::vector<std::pair<Table*, uint64_t>> retiredTables;
+
+	Stripe& stripeFor(uint64_t hashCode) const;
+	Table* prepareStripe(Stripe& stripe);
+	void migrateStripe(Stripe& stripe, Table* to);
+	void retire(Stripe& stripe, Node* node);
+	void grow(Table* seen);
+	bool helperInsert(std::string_view key, string const& value, bool overwrite);
+
+public:
+	ConcurrentUnorderedMap(unsigned int bucketCount, double loadFactor);
+	~ConcurrentUnorderedMap();
+	ConcurrentUnorderedMap(const ConcurrentUnorderedMap&) = delete;
+	ConcurrentUnorderedMap& operator=(const ConcurrentUnorderedMap&) = delete;
+
+	// lock-free
+	bool find(std::string_view key, string& value) const;
+	bool contains(std::string_view key) const;
+
+	// lock one stripe
+	bool insert(std::string_view key, string const& value);	// false, and no change, if the key exists
+	bool upsert(std::string_view key, string const& value);	// returns whether the key existed
+	bool remove(std::string_view key);
+
+	// Visits every entry, one stripe at a time under that stripe's lock. Entries changed concurrently
+	// in other stripes may or may not be seen. visit must not call back into the map.
+	template <typename Visitor>
+	void forEach(Visitor visit);
+
+	size_t size() const;	// exact when no writer is running
+};
+
+inline ConcurrentUnorderedMap::Node::Node(Node* link, uint64_t hash, std::string_view k, string const& v)
+	: next(link), hashCode(hash), key(k), value(v) {
+}
+
+inline ConcurrentUnorderedMap::Table::Table(unsigned int count) {
+	bucketCount = count;
+	buckets = new std::atomic<Node*>[count]();
+}
+
+inline ConcurrentUnorderedMap::Table::~Table() {
+	delete[] buckets;
+}
+
+inline ConcurrentUnorderedMap::ConcurrentUnorderedMap(unsigned int bucketCount, double loadFactor) {
+	unsigned int buckets = STRIPES;
+	while (buckets < bucketCount)
+		buckets *= 2;
+	maxLoad = loadFactor;
+	Table* table = new Table(buckets);
+	for (Stripe& stripe : stripes)
+		stripe.table = table;
+	current = table;
+}
+
+// assumes no other thread is still using the map
+inline ConcurrentUnorderedMap::~ConcurrentUnorderedMap() {
+	for (unsigned int s = 0; s < STRIPES; s++) {
+		Table* table = stripes[s].table.load();
+		for (unsigned int i = s; i < table->bucketCount; i += STRIPES) {
+			Node* node = table->buckets[i].load();
+			while (node) {
+				Node* next = node->next.load();
+				delete node;
+				node = next;
+			}
+		}
+		for (auto& retiredNode : stripes[s].retired)
+			delete retiredNode.first;
+	}
+	for (auto& retiredTable : retiredTables)
+		delete retiredTable.first;
+	delete previous;
+	delete current.load();
+}
+
+inline ConcurrentUnorderedMap::Stripe& ConcurrentUnorderedMap::stripeFor(uint64_t hashCode) const {
+	return stripes[hashCode & (STRIPES - 1)];
+}
+
+// Called with the stripe locked. Moves the stripe into the newest table if a grow() has happened
+// since it was last written, and returns the table to work on.
+inline ConcurrentUnorderedMap::Table* ConcurrentUnorderedMap::prepareStripe(Stripe& stripe) {
+	Table* newest = current.load(std::memory_order_acquire);
+	if (stripe.table.load(std::memory_order_relaxed) != newest)
+		migrateStripe(stripe, newest);
+	return newest;
+}
+
+// Called with the stripe locked. Readers may still be walking the old chains, so the entries are
+// copied rather than relinked, and the old ones retired once the stripe points at the new table.
+inline void ConcurrentUnorderedMap::migrateStripe(Stripe& stripe, Table* to) {
+	Table* from = stripe.table.load(std::memory_order_relaxed);
+	unsigned int first = (unsigned int)(&stripe - stripes);
+	unsigned int mask = to->bucketCount - 1;
+	for (unsigned int i = first; i < from->bucketCount; i += STRIPES) {
+		for (Node* node = from->buckets[i].load(std::memory_order_relaxed); node; node = node->next.load(std::memory_order_relaxed)) {
+			std::atomic<Node*>& head = to->buckets[node->hashCode & mask];
+			head.store(new Node(head.load(std::memory_order_relaxed), node->hashCode, node->key, node->value), std::memory_order_release);
+		}
+	}
+	stripe.table.store(to, std::memory_order_release);
+	for (unsigned int i = first; i < from->bucketCount; i += STRIPES) {
+		Node* node = from->buckets[i].load(std::memory_order_relaxed);
+		while (node) {
+			// with no readers about, retire() can free nodes straight away, this one included
+			Node* next = node->next.load(std::memory_order_relaxed);
+			retire(stripe, node);
+			node = next;
+		}
+	}
+}
+
+// Called with the stripe locked, after node has been unlinked
+inline void ConcurrentUnorderedMap::retire(Stripe& stripe, Node* node) {
+	stripe.retired.emplace_back(node, epochs.retireEpoch());
+	if (stripe.retired.size() >= RECLAIM_BATCH)
+		epochs.reclaim(stripe.retired);
+}
+
+// Publishes a table twice the size of seen, unless another writer already has. Any stripe still
+// left in the table before seen is moved first, so there are never more than two tables in use.
+inline void ConcurrentUnorderedMap::grow(Table* seen) {
+	std::lock_guard<std::mutex> guard(resizeLock);
+	if (current.load() != seen)
+		return;
+	if (previous) {
+		for (Stripe& stripe : stripes) {
+			std::lock_guard<std::mutex> stripeGuard(stripe.lock);
+			prepareStripe(stripe);
+		}
+		retiredTables.emplace_back(previous, epochs.retireEpoch());
+	}
+	previous = seen;
+	current.store(new Table(seen->bucketCount * 2), std::memory_order_release);
+	epochs.reclaim(retiredTables);
+}
+
+// Returns whether the key existed. An existing key keeps its value unless overwrite is set
+inline bool ConcurrentUnorderedMap::helperInsert(std::string_view key, string const& value, bool overwrite) {
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	Stripe& stripe = stripeFor(hashCode);
+	Table* table;
+	{
+		std::lock_guard<std::mutex> guard(stripe.lock);
+		table = prepareStripe(stripe);
+		std::atomic<Node*>& head = table->buckets[hashCode & (table->bucketCount - 1)];
+		for (std::atomic<Node*>* link = &head; Node* node = link->load(std::memory_order_relaxed); link = &node->next) {
+			if (node->hashCode == hashCode && node->key == key) {
+				if (overwrite) {
+					// readers see either the old entry or the new one, never a half written value
+					link->store(new Node(node->next.load(std::memory_order_relaxed), hashCode, key, value), std::memory_order_release);
+					retire(stripe, node);
+				}
+				return true;
+			}
+		}
+		head.store(new Node(head.load(std::memory_order_relaxed), hashCode, key, value), std::memory_order_release);
+		size_t count = stripe.count.load(std::memory_order_relaxed) + 1;
+		stripe.count.store(count, std::memory_order_relaxed);
+		if ((double)count * STRIPES < table->bucketCount * maxLoad)
+			return false;
+	}
+	grow(table);
+	return false;
+}
+
+inline bool ConcurrentUnorderedMap::find(std::string_view key, string& value) const {
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	const Stripe& stripe = stripeFor(hashCode);
+	EpochDomain::Guard guard(epochs);
+	const Table* table = stripe.table.load(std::memory_order_acquire);
+	for (const Node* node = table->buckets[hashCode & (table->bucketCount - 1)].load(std::memory_order_acquire); node; node = node->next.load(std::memory_order_acquire)) {
+		if (node->hashCode == hashCode && node->key == key) {
+			value = node->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline bool ConcurrentUnorderedMap::contains(std::string_view key) const {
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	const Stripe& stripe = stripeFor(hashCode);
+	EpochDomain::Guard guard(epochs);
+	const Table* table = stripe.table.load(std::memory_order_acquire);
+	for (const Node* node = table->buckets[hashCode & (table->bucketCount - 1)].load(std::memory_order_acquire); node; node = node->next.load(std::memory_order_acquire)) {
+		if (node->hashCode == hashCode && node->key == key)
+			return true;
+	}
+	return false;
+}
+
+inline bool ConcurrentUnorderedMap::insert(std::string_view key, string const& value) {
+	return !helperInsert(key, value, false);
+}
+
+inline bool ConcurrentUnorderedMap::upsert(std::string_view key, string const& value) {
+	return helperInsert(key, value, true);
+}
+
+inline bool ConcurrentUnorderedMap::remove(std::string_view key) {
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	Stripe& stripe = stripeFor(hashCode);
+	std::lock_guard<std::mutex> guard(stripe.lock);
+	Table* table = prepareStripe(stripe);
+	std::atomic<Node*>* link = &table->buckets[hashCode & (table->bucketCount - 1)];
+	for (Node* node = link->load(std::memory_order_relaxed); node; link = &node->next, node = link->load(std::memory_order_relaxed)) {
+		if (node->hashCode == hashCode && node->key == key) {
+			// the entry keeps its own next link, so a reader standing on it still reaches the rest of the chain
+			link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+			stripe.count.store(stripe.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+			retire(stripe, node);
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename Visitor>
+void ConcurrentUnorderedMap::forEach(Visitor visit) {
+	for (unsigned int s = 0; s < STRIPES; s++) {
+		std::lock_guard<std::mutex> guard(stripes[s].lock);
+		const Table* table = stripes[s].table.load(std::memory_order_relaxed);
+		for (unsigned int i = s; i < table->bucketCount; i += STRIPES) {
+			for (const Node* node = table->buckets[i].load(std::memory_order_relaxed); node; node = node->next.load(std::memory_order_relaxed))
+				visit(node->key, node->value);
+		}
+	}
+}
+
+inline size_t ConcurrentUnorderedMap::size() const {
+	size_t total = 0;
+	for (const Stripe& stripe : stripes)
+		total += stripe.count.load(std::memory_order_relaxed);
+	return total;
+}
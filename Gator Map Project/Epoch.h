@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Epoch based reclamation for the concurrent maps, whose readers take no locks. A writer that unlinks
+// something can't free it straight away, since a reader may still be looking at it. Instead it tags
+// the object with retireEpoch() and frees it once reclaimable() says every reader that could have
+// seen it has finished.
+//
+// Readers announce themselves in one of two counters of a slot, chosen by the parity of the epoch
+// they started in. The epoch can move from E to E + 1 once no reader that started in E - 1 is left,
+// so readers never straddle more than two epochs, and anything retired in epoch E - 1 or earlier is
+// unreachable by every reader once the epoch reaches E + 1. Threads share slots round robin, which
+// costs contention but not correctness.
+class EpochDomain {
+private:
+	static const unsigned int READER_SLOTS = 64;
+
+	struct alignas(64) ReaderSlot {
+		std::atomic<unsigned int> active[2];
+	};
+
+	mutable ReaderSlot readers[READER_SLOTS];
+	std::atomic<uint64_t> epoch{ 2 };
+
+	static unsigned int readerSlot();
+
+public:
+	// Marks the current thread as reading for as long as it exists. Anything reachable when the guard
+	// is created stays allocated until it is destroyed.
+	class Guard {
+	private:
+		std::atomic<unsigned int>* counter;
+	public:
+		explicit Guard(const EpochDomain& domain);
+		~Guard();
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+	};
+
+	EpochDomain();
+	EpochDomain(const EpochDomain&) = delete;
+	EpochDomain& operator=(const EpochDomain&) = delete;
+
+	uint64_t retireEpoch();
+	void tryAdvance();
+	bool reclaimable(uint64_t retiredAt) const;
+	template <typename T>
+	void reclaim(std::vector<std::pair<T*, uint64_t>>& retired);
+};
+
+inline EpochDomain::Guard::Guard(const EpochDomain& domain) {
+	ReaderSlot& slot = domain.readers[readerSlot()];
+	// If the epoch moves on before the reader is counted, a reclaimer may already have checked that
+	// counter, so count the reader under the new epoch instead
+	for (;;) {
+		uint64_t started = domain.epoch.load();
+		counter = &slot.active[started & 1];
+		counter->fetch_add(1);
+		if (domain.epoch.load() == started)
+			return;
+		counter->fetch_sub(1);
+	}
+}
+
+inline EpochDomain::Guard::~Guard() {
+	counter->fetch_sub(1);
+}
+
+inline EpochDomain::EpochDomain() {
+	for (ReaderSlot& slot : readers) {
+		slot.active[0] = 0;
+		slot.active[1] = 0;
+	}
+}
+
+inline unsigned int EpochDomain::readerSlot() {
+	static std::atomic<unsigned int> nextThread{ 0 };
+	thread_local unsigned int slot = nextThread.fetch_add(1) % READER_SLOTS;
+	return slot;
+}
+
+// The epoch to tag an object with, called after it has been unlinked
+inline uint64_t EpochDomain::retireEpoch() {
+	// the unlink must be visible to everyone before the epoch it is tagged with is read
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return epoch.load();
+}
+
+inline void EpochDomain::tryAdvance() {
+	uint64_t now = epoch.load();
+	for (const ReaderSlot& slot : readers) {
+		if (slot.active[(now - 1) & 1].load() != 0)
+			return;
+	}
+	epoch.compare_exchange_strong(now, now + 1);
+}
+
+inline bool EpochDomain::reclaimable(uint64_t retiredAt) const {
+	return retiredAt + 2 <= epoch.load();
+}
+
+// Tries to move the epoch on, then deletes every object in retired that no reader can reach any more.
+// The caller must make sure nobody else touches retired meanwhile
+template <typename T>
+void EpochDomain::reclaim(std::vector<std::pair<T*, uint64_t>>& retired) {
+	tryAdvance();
+	size_t kept = 0;
+	for (auto& entry : retired) {
+		if (reclaimable(entry.second))
+			delete entry.first;
+		else
+			retired[kept++] = entry;
+	}
+	retired.resize(kept);
+}
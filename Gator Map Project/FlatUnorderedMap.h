@@ -0,0 +1,499 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "Hash.h"
+#include "Memory.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLAT_MAP_SSE2 1
+#endif
+using std::string;
+using std::pair;
+
+// Open addressing alternative to UnorderedMap, laid out like a Swiss table. Entries live
+// directly in one flat slot array instead of in per-bucket linked lists, and every slot has a
+// one byte control code: empty, deleted, or the low 7 bits of the key's hash. A lookup loads
+// the control bytes of 16 neighbouring slots at once, compares all of them against the key's
+// 7 bit tag with one SSE2 instruction, and only touches the slots whose tag matches, so it
+// almost never follows a pointer to a key that isn't the one it wants.
+//
+// Offers the same operator[]/remove/iterator interface as UnorderedMap.
+class FlatUnorderedMap {
+private:
+	static const size_t GROUP_WIDTH = 16;
+	static const int8_t EMPTY = -128;    // 0b10000000
+	static const int8_t DELETED = -2;    // 0b11111110, a tombstone left behind by remove()
+	static const size_t BATCH_GROUP = 16; // keys of a batch whose memory accesses are overlapped
+	// full slots hold a tag between 0 and 127, so the sign bit alone tells full from empty/deleted
+
+	struct Slot {
+		uint64_t hashCode;	// cached so resize() never hashes a key twice
+		string key;
+		string value;
+	};
+
+	// ctrl has capacity + GROUP_WIDTH - 1 bytes: the first GROUP_WIDTH - 1 are mirrored at the
+	// end so a group starting near the end of the table can be loaded without wrapping around
+	int8_t* ctrl = nullptr;
+	Slot* slots = nullptr;
+	size_t capacity;       // number of slots, always a power of two
+	double maxLoad;
+	unsigned int elements;
+	size_t deleted;        // tombstones, which still count against the load until the next rehash
+	MAP_STAT(mutable HashStats counters;) // only in MAP_STATS builds, see Stats.h
+
+	// bitmask of the slots in a group of 16 control bytes that match a condition
+	class Group {
+	private:
+#ifdef FLAT_MAP_SSE2
+		__m128i bytes;
+#else
+		int8_t bytes[GROUP_WIDTH];
+#endif
+	public:
+		explicit Group(const int8_t* position);
+		unsigned int match(int8_t tag) const;
+		unsigned int matchEmpty() const;
+		unsigned int matchEmptyOrDeleted() const;
+	};
+
+	static int8_t tag(uint64_t hashCode);
+	void setCtrl(size_t index, int8_t value);
+	template <bool RecordProbes = false>
+	size_t findSlot(std::string_view key, uint64_t hashCode) const;
+	size_t findInsertSlot(uint64_t hashCode) const;
+	string& findOrInsert(std::string_view key, uint64_t hashCode);
+	template <typename... Args>
+	size_t insertSlot(std::string_view key, uint64_t hashCode, Args&&... args);
+	void prefetchGroup(const std::string_view* keys, size_t count, uint64_t* hashCodes) const;
+	void resize(size_t newCapacity);
+	size_t groupsProbed(uint64_t hashCode, size_t index) const;
+	static unsigned int lowestBit(unsigned int mask);
+
+public:
+	class Iterator;
+	FlatUnorderedMap(unsigned int bucketCount, double loadFactor);
+	~FlatUnorderedMap();
+	FlatUnorderedMap(const FlatUnorderedMap&) = delete;
+	FlatUnorderedMap& operator=(const FlatUnorderedMap&) = delete;
+	Iterator begin() const;
+	Iterator end() const;
+	string& operator[] (std::string_view key);
+	// Adds key with a value constructed in place from args, as on UnorderedMap
+	template <typename... Args>
+	bool emplace(std::string_view key, Args&&... args);
+	// Lookups that never insert, allocate or rehash, as on UnorderedMap
+	Iterator find(std::string_view key) const;
+	bool contains(std::string_view key) const;
+	string& at(std::string_view key);
+	const string& at(std::string_view key) const;
+	// Batched lookups and inserts, as on UnorderedMap
+	void findBatch(const std::string_view* keys, size_t count, const string** values) const;
+	void insertBatch(const std::string_view* keys, const string* values, size_t count);
+	void rehash();
+	void remove(std::string_view key);
+	unsigned int size();
+	double loadFactor();
+	// As on UnorderedMap. chainLengths holds, for every entry, the groups a lookup of it probes
+	HashStats stats() const;
+	void resetStats();
+	// As on UnorderedMap. Entries live in the slot array, which is all table
+	MemoryUsage memoryUsage() const;
+
+	class Iterator {
+	private:
+		size_t index;
+		const FlatUnorderedMap* mapPtr = nullptr;
+
+	public:
+		Iterator(size_t slot, const FlatUnorderedMap* p2);
+		Iterator& operator++();
+		bool operator!=(Iterator const& rhs);
+		bool operator==(Iterator const& rhs);
+		pair<std::string_view, const string&> operator*() const;
+		friend class FlatUnorderedMap;
+	};
+};
+
+inline FlatUnorderedMap::Group::Group(const int8_t* position) {
+#ifdef FLAT_MAP_SSE2
+	bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+#else
+	std::memcpy(bytes, position, GROUP_WIDTH);
+#endif
+}
+
+// bit i is set if slot i of the group holds the given tag
+inline unsigned int FlatUnorderedMap::Group::match(int8_t tag) const {
+#ifdef FLAT_MAP_SSE2
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), bytes));
+#else
+	unsigned int mask = 0;
+	for (size_t i = 0; i < GROUP_WIDTH; i++) {
+		if (bytes[i] == tag)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+inline unsigned int FlatUnorderedMap::Group::matchEmpty() const {
+	return match(EMPTY);
+}
+
+// empty and deleted are the only codes with the sign bit set
+inline unsigned int FlatUnorderedMap::Group::matchEmptyOrDeleted() const {
+#ifdef FLAT_MAP_SSE2
+	return (unsigned int)_mm_movemask_epi8(bytes);
+#else
+	unsigned int mask = 0;
+	for (size_t i = 0; i < GROUP_WIDTH; i++) {
+		if (bytes[i] < 0)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+// index of the lowest set bit of a non-zero group mask
+inline unsigned int FlatUnorderedMap::lowestBit(unsigned int mask) {
+	unsigned int index = 0;
+	while ((mask & 1u) == 0) {
+		mask >>= 1;
+		index++;
+	}
+	return index;
+}
+
+// hashKey() mixes every bit, so the high bits pick the starting group and the low 7 bits become the tag
+inline int8_t FlatUnorderedMap::tag(uint64_t hashCode) {
+	return (int8_t)(hashCode & 0x7F);
+}
+
+// writes a control byte and its mirror past the end of the table
+inline void FlatUnorderedMap::setCtrl(size_t index, int8_t value) {
+	ctrl[index] = value;
+	ctrl[((index - (GROUP_WIDTH - 1)) & (capacity - 1)) + (GROUP_WIDTH - 1)] = value;
+}
+
+inline FlatUnorderedMap::FlatUnorderedMap(unsigned int bucketCount, double loadFactor) {
+	// open addressing needs some empty slots to end each probe, so the load is capped at 7/8
+	maxLoad = loadFactor > 0.875 ? 0.875 : loadFactor;
+	elements = 0;
+	deleted = 0;
+	capacity = GROUP_WIDTH;
+	while (capacity < bucketCount)
+		capacity *= 2;
+	ctrl = new int8_t[capacity + GROUP_WIDTH - 1];
+	std::memset(ctrl, EMPTY, capacity + GROUP_WIDTH - 1);
+	slots = static_cast<Slot*>(::operator new(sizeof(Slot) * capacity));
+}
+
+inline FlatUnorderedMap::~FlatUnorderedMap() {
+	for (size_t i = 0; i < capacity; i++) {
+		if (ctrl[i] >= 0)
+			slots[i].~Slot();
+	}
+	::operator delete(slots);
+	delete[] ctrl;
+}
+
+// probes group by group from the key's home group, returning the key's slot or capacity if it is absent.
+// a group that still has an empty slot ends the search, since an insert would have stopped there.
+// only the lookup entry points set RecordProbes, so probeLengths counts lookups alone
+template <bool RecordProbes>
+size_t FlatUnorderedMap::findSlot(std::string_view key, uint64_t hashCode) const {
+	size_t mask = capacity - 1;
+	size_t position = (size_t)(hashCode >> 7) & mask;
+	int8_t keyTag = tag(hashCode);
+	for (size_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+		Group group(ctrl + position);
+		for (unsigned int candidates = group.match(keyTag); candidates != 0; candidates &= candidates - 1) {
+			size_t index = (position + lowestBit(candidates)) & mask;
+			if (slots[index].hashCode == hashCode && slots[index].key == key) {
+				MAP_STAT(if (RecordProbes) counters.probeLengths.add(step / GROUP_WIDTH);)
+				return index;
+			}
+		}
+		if (group.matchEmpty() != 0) {
+			MAP_STAT(if (RecordProbes) counters.probeLengths.add(step / GROUP_WIDTH);)
+			return capacity;
+		}
+		position = (position + step) & mask; // triangular probing visits every group once
+	}
+}
+
+// first empty or deleted slot on the key's probe sequence
+inline size_t FlatUnorderedMap::findInsertSlot(uint64_t hashCode) const {
+	size_t mask = capacity - 1;
+	size_t position = (size_t)(hashCode >> 7) & mask;
+	for (size_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+		unsigned int available = Group(ctrl + position).matchEmptyOrDeleted();
+		if (available != 0)
+			return (position + lowestBit(available)) & mask;
+		position = (position + step) & mask;
+	}
+}
+
+// moves every entry into a new table of newCapacity slots, dropping all tombstones
+inline void FlatUnorderedMap::resize(size_t newCapacity) {
+	int8_t* oldCtrl = ctrl;
+	Slot* oldSlots = slots;
+	size_t oldCapacity = capacity;
+
+	capacity = newCapacity;
+	ctrl = new int8_t[capacity + GROUP_WIDTH - 1];
+	std::memset(ctrl, EMPTY, capacity + GROUP_WIDTH - 1);
+	slots = static_cast<Slot*>(::operator new(sizeof(Slot) * capacity));
+	deleted = 0;
+
+	for (size_t i = 0; i < oldCapacity; i++) {
+		if (oldCtrl[i] >= 0) {
+			uint64_t hashCode = oldSlots[i].hashCode;
+			size_t index = findInsertSlot(hashCode);
+			setCtrl(index, tag(hashCode));
+			new (&slots[index]) Slot(std::move(oldSlots[i]));
+			oldSlots[i].~Slot();
+		}
+	}
+	::operator delete(oldSlots);
+	delete[] oldCtrl;
+}
+
+// how many groups a lookup of the entry in slot index probes, following the same sequence as findSlot()
+inline size_t FlatUnorderedMap::groupsProbed(uint64_t hashCode, size_t index) const {
+	size_t mask = capacity - 1;
+	size_t position = (size_t)(hashCode >> 7) & mask;
+	size_t groups = 1;
+	for (size_t step = GROUP_WIDTH; ((index - position) & mask) >= GROUP_WIDTH; step += GROUP_WIDTH) {
+		position = (position + step) & mask;
+		groups++;
+	}
+	return groups;
+}
+
+inline FlatUnorderedMap::Iterator FlatUnorderedMap::begin() const {
+	Iterator iter(0, this);
+	// Find the first full slot, if any
+	if (capacity > 0 && ctrl[0] < 0)
+		++iter;
+	return iter;
+}
+
+inline FlatUnorderedMap::Iterator FlatUnorderedMap::end() const {
+	return Iterator(capacity, this);
+}
+
+// timed as a lookup when the key is found and as an insert when it has to be added
+inline string& FlatUnorderedMap::operator[] (std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	size_t index = findSlot(key, hashCode);
+	if (index == capacity) {
+		MAP_STAT(timer.chargeTo(counters.insertNs);)
+		index = insertSlot(key, hashCode);
+	}
+	return slots[index].value;
+}
+
+template <typename... Args>
+bool FlatUnorderedMap::emplace(std::string_view key, Args&&... args) {
+	MAP_STAT(StatTimer timer(counters.insertNs);)
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	if (findSlot(key, hashCode) != capacity)
+		return false;
+	insertSlot(key, hashCode, std::forward<Args>(args)...);
+	return true;
+}
+
+inline string& FlatUnorderedMap::findOrInsert(std::string_view key, uint64_t hashCode) {
+	size_t index = findSlot(key, hashCode);
+
+	// If key doesn't exist, construct an empty value for it
+	if (index == capacity)
+		index = insertSlot(key, hashCode);
+
+	return slots[index].value;
+}
+
+// Constructs a key that isn't in the map yet, and its value built from args, in the first free slot
+// on its probe sequence. rehash() keeps the table under the max load, so there is always one.
+// Returns the slot the entry ends up in
+template <typename... Args>
+size_t FlatUnorderedMap::insertSlot(std::string_view key, uint64_t hashCode, Args&&... args) {
+	size_t index = findInsertSlot(hashCode);
+	if (ctrl[index] == DELETED)
+		deleted--;
+	setCtrl(index, tag(hashCode));
+	new (&slots[index]) Slot{ hashCode, string(key), string(std::forward<Args>(args)...) };
+	elements++;
+	if ((double)(elements + deleted) >= capacity * maxLoad) {
+		rehash();
+		// Find the slot again since the entries have moved
+		index = findSlot(key, hashCode);
+	}
+	return index;
+}
+
+// hashes a group of keys and starts loading the control bytes and first slot of each key's home group
+inline void FlatUnorderedMap::prefetchGroup(const std::string_view* keys, size_t count, uint64_t* hashCodes) const {
+	for (size_t i = 0; i < count; i++) {
+		hashCodes[i] = hashKey(keys[i].data(), keys[i].size());
+		size_t position = (size_t)(hashCodes[i] >> 7) & (capacity - 1);
+		prefetch(ctrl + position);
+		prefetch(slots + position);
+	}
+}
+
+inline void FlatUnorderedMap::findBatch(const std::string_view* keys, size_t count, const string** values) const {
+	uint64_t hashCodes[BATCH_GROUP];
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		prefetchGroup(keys + first, group, hashCodes);
+		for (size_t i = 0; i < group; i++) {
+			size_t index = findSlot<true>(keys[first + i], hashCodes[i]);
+			values[first + i] = index == capacity ? nullptr : &slots[index].value;
+		}
+	}
+}
+
+// a resize partway through a group only makes the rest of its prefetches useless, never wrong
+inline void FlatUnorderedMap::insertBatch(const std::string_view* keys, const string* values, size_t count) {
+	uint64_t hashCodes[BATCH_GROUP];
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		prefetchGroup(keys + first, group, hashCodes);
+		for (size_t i = 0; i < group; i++)
+			findOrInsert(keys[first + i], hashCodes[i]) = values[first + i];
+	}
+}
+
+inline FlatUnorderedMap::Iterator FlatUnorderedMap::find(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	return Iterator(findSlot<true>(key, hashKey(key.data(), key.size())), this);
+}
+
+inline bool FlatUnorderedMap::contains(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	return findSlot<true>(key, hashKey(key.data(), key.size())) != capacity;
+}
+
+// throws std::out_of_range if the key is missing
+inline string& FlatUnorderedMap::at(std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	size_t index = findSlot<true>(key, hashKey(key.data(), key.size()));
+	if (index == capacity)
+		throw std::out_of_range("FlatUnorderedMap::at: key not found");
+	return slots[index].value;
+}
+
+inline const string& FlatUnorderedMap::at(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	size_t index = findSlot<true>(key, hashKey(key.data(), key.size()));
+	if (index == capacity)
+		throw std::out_of_range("FlatUnorderedMap::at: key not found");
+	return slots[index].value;
+}
+
+// grows the table once live entries plus tombstones reach the max load. when at least half of that
+// is tombstones the table is rebuilt at the same size instead, which clears them out without growing
+inline void FlatUnorderedMap::rehash() {
+	if ((double)(elements + deleted) >= capacity * maxLoad) {
+		MAP_STAT(StatTimer timer(counters.rehashNs);)
+		if (deleted >= elements)
+			resize(capacity);
+		else
+			resize(capacity * 2);
+	}
+}
+
+inline void FlatUnorderedMap::remove(std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.removeNs);)
+	size_t index = findSlot(key, hashKey(key.data(), key.size()));
+	if (index == capacity)
+		return;
+	slots[index].~Slot();
+	setCtrl(index, DELETED); // probes for other keys may pass through this slot, so it can't become empty
+	deleted++;
+	elements--;
+}
+
+inline unsigned int FlatUnorderedMap::size() {
+	return elements;
+}
+
+inline double FlatUnorderedMap::loadFactor() {
+	return ((double)elements / capacity);
+}
+
+inline HashStats FlatUnorderedMap::stats() const {
+	HashStats result;
+	MAP_STAT(result = counters;)
+	result.elements = elements;
+	result.buckets = capacity;
+	result.loadFactor = (double)elements / capacity;
+	for (size_t i = 0; i < capacity; i++) {
+		if (ctrl[i] >= 0)
+			result.chainLengths.add(groupsProbed(slots[i].hashCode, i));
+	}
+	return result;
+}
+
+inline void FlatUnorderedMap::resetStats() {
+	MAP_STAT(counters = HashStats();)
+}
+
+inline MemoryUsage FlatUnorderedMap::memoryUsage() const {
+	MemoryUsage usage;
+	usage.table = capacity + GROUP_WIDTH - 1 + capacity * sizeof(Slot);
+	for (size_t i = 0; i < capacity; i++) {
+		if (ctrl[i] >= 0) {
+			usage.keys += heapBytes(slots[i].key);
+			usage.values += heapBytes(slots[i].value);
+		}
+	}
+	usage.other = sizeof(*this);
+	return usage;
+}
+
+inline FlatUnorderedMap::Iterator::Iterator(size_t slot, const FlatUnorderedMap* p2) {
+	index = slot;
+	mapPtr = p2;
+}
+
+// skips ahead to the next full slot, a group of control bytes at a time
+inline FlatUnorderedMap::Iterator& FlatUnorderedMap::Iterator::operator++() {
+	index++;
+	while (index < mapPtr->capacity) {
+		unsigned int full = ~Group(mapPtr->ctrl + index).matchEmptyOrDeleted() & 0xFFFF;
+		if (full != 0) {
+			index += lowestBit(full);
+			break;
+		}
+		index += GROUP_WIDTH;
+	}
+	// the mirrored control bytes past the end can produce a match beyond the last slot
+	if (index > mapPtr->capacity)
+		index = mapPtr->capacity;
+	return *this;
+}
+
+inline bool FlatUnorderedMap::Iterator::operator!=(Iterator const& rhs) {
+	return (index != rhs.index);
+}
+
+inline bool FlatUnorderedMap::Iterator::operator==(Iterator const& rhs) {
+	return (index == rhs.index);
+}
+
+inline pair<std::string_view, const string&> FlatUnorderedMap::Iterator::operator*() const {
+	const Slot& slot = mapPtr->slots[index];
+	return pair<std::string_view, const string&>(slot.key, slot.value);
+}
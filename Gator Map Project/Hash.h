@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// 64 bit string hash shared by the unordered maps (MurmurHash64A). Keys are consumed eight
+// bytes per step instead of one, and the final avalanche mixes every input bit into both
+// the low bits (used for bucket indexes) and the high bits (used by FlatUnorderedMap).
+inline uint64_t hashKey(const char* key, size_t length) {
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+	uint64_t hashCode = 0x8445d61a4e774912ull ^ (length * m);
+
+	const char* end = key + (length & ~(size_t)7);
+	for (; key != end; key += 8) {
+		uint64_t word;
+		std::memcpy(&word, key, 8); // unaligned load, compiles to a single mov
+		word *= m;
+		word ^= word >> r;
+		word *= m;
+		hashCode ^= word;
+		hashCode *= m;
+	}
+
+	// Fold in the last 0-7 bytes
+	size_t remaining = length & 7;
+	if (remaining != 0) {
+		uint64_t word = 0;
+		std::memcpy(&word, key, remaining);
+		hashCode ^= word;
+		hashCode *= m;
+	}
+
+	hashCode ^= hashCode >> r;
+	hashCode *= m;
+	hashCode ^= hashCode >> r;
+	return hashCode;
+}
+
+inline uint64_t hashKey(std::string const& key) {
+	return hashKey(key.data(), key.size());
+}
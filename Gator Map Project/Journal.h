@@ -0,0 +1,391 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Hash.h"
+#include "Snapshot.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Write-ahead log for the maps. Every mutation appends a small binary record to an in-memory buffer,
+// which a background thread writes out and fsyncs. Writers that need their record on disk wait for
+// that thread, and however many of them are waiting share a single fsync (group commit).
+//
+// The log is split into numbered segments next to a snapshot:
+//
+//   base.snapshot  base.log.0  base.log.1 ...
+//
+// Once the open segment passes compactBytes it is closed and a second thread folds it into the
+// snapshot: it loads the snapshot into a scratch map, replays the segment over it, saves the result
+// and deletes the segment. The live map is never read, so compaction needs no locking, at the cost
+// of a second copy of the map while it runs.
+//
+// Records hold the effect of a mutation (PUT, REMOVE, ...), never a failed one, so replaying a
+// segment on top of a snapshot that already contains it leaves the snapshot unchanged. That makes a
+// crash between saving the snapshot and deleting the segments harmless. Segments are only deleted
+// once the new snapshot and its directory entry have been synced, so this holds for a power loss as
+// well as a process crash.
+//
+// A record is [body length][checksum of body][type][fields], the fields encoded like a snapshot's.
+// A crash can leave the last record of a segment half written; replay stops at the first record
+// whose checksum doesn't match.
+struct JournalOptions {
+	// Make every mutation wait until its record is on disk. Otherwise records are synced every
+	// flushInterval and Journal::sync() waits for everything written so far
+	bool syncEachWrite = false;
+	std::chrono::milliseconds flushInterval{ 10 };
+	// Size at which a segment is closed and compacted into the snapshot
+	uint64_t compactBytes = 64ull << 20;
+};
+
+class Journal {
+public:
+	enum RecordType : uint8_t {
+		PUT = 1,	// key value: key now maps to value
+		INSERT = 2,	// key value: key maps to value unless it is already present
+		REMOVE = 3,	// key
+		CLEAR = 4	// no fields
+	};
+
+	// Folds segments, oldest first, into the snapshot at the given path. Called on the compaction thread
+	using Compactor = std::function<bool(const std::string& snapshot, const std::vector<std::string>& segments)>;
+
+	// Starts a new segment after any that already exist. Those are assumed to have been replayed
+	// already and are queued for compaction
+	Journal(const std::string& base, const JournalOptions& options, Compactor compactor);
+	// Writes out and syncs every record before returning
+	~Journal();
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	template <typename... Fields>
+	void append(RecordType type, const Fields&... fields);
+	// Waits until every record appended so far is on disk
+	void sync();
+	// Closes the current segment and compacts it without waiting for it to fill up
+	void compact();
+	// False once writing the log has failed. Records appended after that are not durable
+	bool ok();
+
+	static std::string snapshotPath(const std::string& base);
+	// Segment files of base, oldest first
+	static std::vector<std::string> segments(const std::string& base);
+	// Calls apply(type, fields) for each record of segment in order. Returns false if the segment
+	// ends in a torn or damaged record, which is skipped along with anything after it
+	template <typename Apply>
+	static bool replay(const std::string& segment, Apply apply);
+
+private:
+	static const size_t FLUSH_BYTES = 1 << 20;	// pending bytes that wake the flusher early
+
+	struct Buffer {
+		std::string bytes;
+		void write(const void* data, size_t size);
+	};
+
+	std::string base;
+	JournalOptions options;
+	Compactor compactor;
+
+	std::mutex mutex;
+	std::condition_variable flushWork;	// wakes the flusher
+	std::condition_variable flushed;	// wakes writers waiting for their records
+	std::condition_variable compactWork;	// wakes the compactor
+	Buffer pending;	// records not yet handed to the flusher
+	uint64_t appended = 0;	// records appended so far
+	uint64_t durable = 0;	// records known to be on disk
+	unsigned int waiting = 0;	// writers blocked until their records are durable
+	bool rotateRequested = false;
+	bool stopping = false;
+	bool failed = false;
+	std::vector<std::string> compactQueue;	// closed segments, oldest first
+
+	// Only used by the flusher thread once it is running
+	int file = -1;
+	uint64_t segmentNumber = 0;
+	uint64_t segmentBytes = 0;
+	std::string spare;	// buffer swapped with pending, so neither is ever reallocated
+
+	std::thread flusher;
+	std::thread compactorThread;
+
+	static std::vector<std::pair<uint64_t, std::string>> listSegments(const std::string& base);
+	static int openFile(const std::string& path);
+	static bool writeFile(int fd, const char* data, size_t size);
+	static bool syncFile(int fd);
+	static void closeFile(int fd);
+	std::string segmentPath(uint64_t number) const;
+	void waitDurable(std::unique_lock<std::mutex>& lock, uint64_t record);
+	void flushLoop();
+	void compactLoop();
+};
+
+inline void Journal::Buffer::write(const void* data, size_t size) {
+	bytes.append((const char*)data, size);
+}
+
+inline Journal::Journal(const std::string& base, const JournalOptions& options, Compactor compactor)
+	: base(base), options(options), compactor(std::move(compactor)) {
+	for (auto& segment : listSegments(base)) {
+		compactQueue.push_back(segment.second);
+		segmentNumber = segment.first + 1;
+	}
+	file = openFile(segmentPath(segmentNumber));
+	failed = file < 0;
+	flusher = std::thread(&Journal::flushLoop, this);
+	compactorThread = std::thread(&Journal::compactLoop, this);
+}
+
+inline Journal::~Journal() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	flushWork.notify_one();
+	compactWork.notify_one();
+	flusher.join();
+	compactorThread.join();
+	closeFile(file);
+}
+
+// The record is framed in place at the end of pending, so appending costs one lock and a copy
+template <typename... Fields>
+void Journal::append(RecordType type, const Fields&... fields) {
+	std::unique_lock<std::mutex> lock(mutex);
+	size_t start = pending.bytes.size();
+	uint32_t header[2] = { 0, 0 };
+	pending.write(header, sizeof(header));
+	pending.write(&type, 1);
+	(writeField(pending, fields), ...);
+
+	const char* body = pending.bytes.data() + start + sizeof(header);
+	header[0] = (uint32_t)(pending.bytes.size() - start - sizeof(header));
+	header[1] = (uint32_t)hashKey(body, header[0]);
+	std::memcpy(&pending.bytes[start], header, sizeof(header));
+
+	uint64_t record = ++appended;
+	if (options.syncEachWrite)
+		waitDurable(lock, record);
+	else if (pending.bytes.size() >= FLUSH_BYTES)
+		flushWork.notify_one();
+}
+
+inline void Journal::sync() {
+	std::unique_lock<std::mutex> lock(mutex);
+	waitDurable(lock, appended);
+}
+
+inline void Journal::compact() {
+	std::lock_guard<std::mutex> lock(mutex);
+	rotateRequested = true;
+	flushWork.notify_one();
+}
+
+inline bool Journal::ok() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return !failed;
+}
+
+inline std::string Journal::snapshotPath(const std::string& base) {
+	return base + ".snapshot";
+}
+
+inline std::vector<std::string> Journal::segments(const std::string& base) {
+	std::vector<std::string> paths;
+	for (auto& segment : listSegments(base))
+		paths.push_back(std::move(segment.second));
+	return paths;
+}
+
+template <typename Apply>
+bool Journal::replay(const std::string& segment, Apply apply) {
+	MappedFile file;
+	if (!file.open(segment))
+		return true; // empty segments can't be mapped, and have nothing to replay anyway
+	ByteReader reader(file.data(), file.size());
+	while (!reader.atEnd()) {
+		uint32_t header[2];
+		std::string_view body;
+		if (!reader.read(header, sizeof(header)) || !reader.readView(body, header[0]) || body.empty()
+			|| (uint32_t)hashKey(body.data(), body.size()) != header[1])
+			return false;
+		ByteReader fields(body.data() + 1, body.size() - 1);
+		apply((RecordType)body[0], fields);
+	}
+	return true;
+}
+
+inline std::vector<std::pair<uint64_t, std::string>> Journal::listSegments(const std::string& base) {
+	namespace fs = std::filesystem;
+	fs::path basePath(base);
+	fs::path directory = basePath.parent_path();
+	if (directory.empty())
+		directory = ".";
+	std::string prefix = basePath.filename().string() + ".log.";
+
+	std::vector<std::pair<uint64_t, std::string>> found;
+	std::error_code error;
+	for (const auto& entry : fs::directory_iterator(directory, error)) {
+		std::string name = entry.path().filename().string();
+		if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+			continue;
+		std::string number = name.substr(prefix.size());
+		if (number.find_first_not_of("0123456789") != std::string::npos)
+			continue;
+		found.emplace_back(std::strtoull(number.c_str(), nullptr, 10), entry.path().string());
+	}
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+inline int Journal::openFile(const std::string& path) {
+#ifdef _WIN32
+	return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd >= 0)
+		syncDirectory(path); // the new file's directory entry has to be durable too, or a crash could lose the whole segment
+	return fd;
+#endif
+}
+
+inline bool Journal::writeFile(int fd, const char* data, size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		int written = _write(fd, data, (unsigned int)std::min<size_t>(size, 1u << 30));
+#else
+		ssize_t written = ::write(fd, data, size);
+#endif
+		if (written <= 0)
+			return false;
+		data += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+inline bool Journal::syncFile(int fd) {
+#ifdef _WIN32
+	return _commit(fd) == 0;
+#elif defined(__linux__)
+	return fdatasync(fd) == 0;
+#else
+	return fsync(fd) == 0;
+#endif
+}
+
+inline void Journal::closeFile(int fd) {
+	if (fd < 0)
+		return;
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+}
+
+inline std::string Journal::segmentPath(uint64_t number) const {
+	return base + ".log." + std::to_string(number);
+}
+
+inline void Journal::waitDurable(std::unique_lock<std::mutex>& lock, uint64_t record) {
+	waiting++;
+	flushWork.notify_one();
+	flushed.wait(lock, [&] { return durable >= record || failed; });
+	waiting--;
+}
+
+// Writes out whatever has been appended each time it wakes: every flushInterval, as soon as a writer
+// is waiting, or when enough bytes have piled up. Records appended while one batch is being synced
+// all go out together in the next one
+inline void Journal::flushLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		flushWork.wait_for(lock, options.flushInterval, [this] {
+			return stopping || waiting > 0 || rotateRequested || pending.bytes.size() >= FLUSH_BYTES;
+		});
+		bool stop = stopping;
+		bool rotate = rotateRequested;
+		rotateRequested = false;
+		uint64_t target = appended;
+		spare.swap(pending.bytes);
+		lock.unlock();
+
+		bool written = file >= 0;
+		if (written && !spare.empty()) {
+			written = writeFile(file, spare.data(), spare.size()) && syncFile(file);
+			segmentBytes += spare.size();
+		}
+		spare.clear();
+
+		std::string closed;
+		if (written && !stop && segmentBytes > 0 && (rotate || segmentBytes >= options.compactBytes)) {
+			closed = segmentPath(segmentNumber);
+			closeFile(file);
+			file = openFile(segmentPath(++segmentNumber));
+			segmentBytes = 0;
+		}
+
+		lock.lock();
+		if (written)
+			durable = target;
+		else
+			failed = true;
+		if (file < 0)
+			failed = true;
+		flushed.notify_all();
+		if (!closed.empty()) {
+			compactQueue.push_back(std::move(closed));
+			compactWork.notify_one();
+		}
+		if (stop)
+			return;
+	}
+}
+
+// Folds closed segments into the snapshot one batch at a time. A batch that fails to compact is kept
+// and retried, oldest first, along with the next segment to be closed. Segments still queued at
+// shutdown are replayed and compacted after the next start
+inline void Journal::compactLoop() {
+	std::vector<std::string> retry;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		compactWork.wait(lock, [this] { return stopping || !compactQueue.empty(); });
+		if (stopping)
+			return;
+		std::vector<std::string> batch;
+		batch.swap(retry);
+		batch.insert(batch.end(), compactQueue.begin(), compactQueue.end());
+		compactQueue.clear();
+		lock.unlock();
+
+		// the compactor returns true only once the snapshot is synced, so the segments are no longer needed
+		if (compactor(snapshotPath(base), batch)) {
+			for (const std::string& segment : batch)
+				std::remove(segment.c_str());
+		}
+		else {
+			retry.swap(batch);
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// Memory accounting for the maps. memoryUsage() on each map breaks the bytes it holds down by what
+// they are for:
+//
+//   - table, nodes and freeNodes come straight from the map's own arrays and node pools, whose sizes
+//     it always knows.
+//   - keys and values are the heap buffers of strings too long to be stored inline.
+//   - index is the name index. Its standard containers allocate through a CountingAllocator, so it
+//     is counted as it grows.
+//
+// malloc's own per-allocation overhead isn't included, so the process's resident size will be a
+// little higher than the total.
+struct MemoryUsage {
+	size_t table = 0;	// bucket arrays, or the control bytes and slots of open addressing
+	size_t nodes = 0;	// pooled nodes in use, with the keys and values stored inside them
+	size_t freeNodes = 0;	// pooled nodes allocated but not in use: freed by removes and kept for reuse, or not handed out yet
+	size_t keys = 0;	// key characters kept outside the nodes: arena blocks, long strings' buffers
+	size_t values = 0;	// heap buffers of values too long to be stored inline
+	size_t index = 0;	// the value -> keys index, while enabled
+	size_t other = 0;	// the map object itself and its bookkeeping
+
+	size_t total() const;
+	void print(std::ostream& out) const;
+};
+
+// Bytes currently allocated through it, and the most there have ever been at once
+class MemoryCounter {
+private:
+	size_t current = 0;
+	size_t highest = 0;
+
+public:
+	void add(size_t bytes);
+	void remove(size_t bytes);
+	size_t bytes() const;
+	size_t peak() const;
+};
+
+// Standard allocator that counts everything it hands out in a MemoryCounter. Copies, and the rebound
+// copies containers make for their nodes, all count into the same counter, which has to outlive them
+template <typename T>
+class CountingAllocator {
+public:
+	using value_type = T;
+	MemoryCounter* counter;
+
+	explicit CountingAllocator(MemoryCounter* counter) noexcept : counter(counter) {}
+	template <typename U>
+	CountingAllocator(const CountingAllocator<U>& other) noexcept : counter(other.counter) {}
+
+	T* allocate(size_t count) {
+		T* memory = std::allocator<T>().allocate(count);
+		counter->add(count * sizeof(T));
+		return memory;
+	}
+	void deallocate(T* memory, size_t count) noexcept {
+		counter->remove(count * sizeof(T));
+		std::allocator<T>().deallocate(memory, count);
+	}
+	template <typename U>
+	bool operator==(const CountingAllocator<U>& other) const noexcept { return counter == other.counter; }
+	template <typename U>
+	bool operator!=(const CountingAllocator<U>& other) const noexcept { return counter != other.counter; }
+};
+
+// Heap bytes held by a key or value beyond its own size. Strings short enough for their inline
+// buffer hold none; anything that isn't a string is assumed to hold none
+template <typename T>
+size_t heapBytes(const T&) {
+	return 0;
+}
+
+inline size_t heapBytes(const std::string& text) {
+	static const size_t INLINE_CAPACITY = std::string().capacity();
+	return text.capacity() > INLINE_CAPACITY ? text.capacity() + 1 : 0;
+}
+
+inline size_t MemoryUsage::total() const {
+	return table + nodes + freeNodes + keys + values + index + other;
+}
+
+inline void MemoryUsage::print(std::ostream& out) const {
+	out << "total " << total() << " bytes: table " << table << ", nodes " << nodes << ", free nodes " << freeNodes
+		<< ", keys " << keys << ", values " << values << ", index " << index << ", other " << other << "\n";
+}
+
+inline void MemoryCounter::add(size_t bytes) {
+	current += bytes;
+	if (current > highest)
+		highest = current;
+}
+
+inline void MemoryCounter::remove(size_t bytes) {
+	current -= bytes;
+}
+
+inline size_t MemoryCounter::bytes() const {
+	return current;
+}
+
+inline size_t MemoryCounter::peak() const {
+	return highest;
+}
+
+// The process's resident memory now, and the most it has had so far, in bytes. 0 where the platform
+// doesn't say
+inline size_t currentRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize;
+#else
+	// Linux only: the second field of statm is the resident size in pages
+	std::FILE* statm = std::fopen("/proc/self/statm", "r");
+	if (statm == nullptr)
+		return 0;
+	unsigned long long size = 0;
+	unsigned long long resident = 0;
+	int fields = std::fscanf(statm, "%llu %llu", &size, &resident);
+	std::fclose(statm);
+	return fields == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+inline size_t peakRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss; // bytes on macOS
+#else
+	return (size_t)usage.ru_maxrss * 1024; // kilobytes elsewhere
+#endif
+#endif
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <functional>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "Memory.h"
+
+// Optional secondary index from a value (a student's name, for the string-ID maps) to every
+// key that has it, shared by the ordered map backends. Values are not unique, so each one maps
+// to a set of keys sorted like the tree. Only a hashable Value can be indexed: for any other the
+// index below is an empty stand-in, so the trees still hold any value type.
+// While the index is disabled add()/remove() do nothing and it holds no memory.
+// Both containers allocate through a CountingAllocator, so memoryUsage() knows what they hold.
+template <typename Value>
+constexpr bool isHashable = std::is_default_constructible<std::hash<Value>>::value;
+
+template <typename Key, typename Value, typename Compare = std::less<Key>, bool Hashable = isHashable<Value>>
+class NameIndex {
+private:
+    using KeySet = std::set<Key, Compare, CountingAllocator<Key>>;
+    using Entry = std::pair<const Value, KeySet>;
+
+    bool enabled = false;
+    MemoryCounter memory; // declared before keys, which counts into it until it is destroyed
+    std::unordered_map<Value, KeySet, std::hash<Value>, std::equal_to<Value>, CountingAllocator<Entry>> keys{
+        0, std::hash<Value>(), std::equal_to<Value>(), CountingAllocator<Entry>(&memory) };
+
+public:
+    bool isEnabled() const;
+    void setEnabled(bool enable);
+    void add(const Value& value, const Key& key);
+    void remove(const Value& value, const Key& key);
+    std::vector<Key> find(const Value& value) const;
+    void clear();
+    size_t memoryUsage() const;
+};
+
+// A Value without std::hash can't be indexed, so there is nothing to store. keysWithValue() always
+// scans, and asking for the index is a compile error
+template <typename Key, typename Value, typename Compare>
+class NameIndex<Key, Value, Compare, false> {
+public:
+    bool isEnabled() const { return false; }
+    void setEnabled(bool enable) {
+        static_assert(sizeof(Value) == 0, "the name index needs a Value that std::hash supports");
+        (void)enable;
+    }
+    void add(const Value&, const Key&) {}
+    void remove(const Value&, const Key&) {}
+    std::vector<Key> find(const Value&) const { return {}; }
+    void clear() {}
+    size_t memoryUsage() const { return 0; }
+};
+
+template <typename Key, typename Value, typename Compare, bool Hashable>
+bool NameIndex<Key, Value, Compare, Hashable>::isEnabled() const {
+    return enabled;
+}
+
+// turning the index on or off always starts it empty. the owner refills it from its entries
+template <typename Key, typename Value, typename Compare, bool Hashable>
+void NameIndex<Key, Value, Compare, Hashable>::setEnabled(bool enable) {
+    keys.clear();
+    enabled = enable;
+}
+
+template <typename Key, typename Value, typename Compare, bool Hashable>
+void NameIndex<Key, Value, Compare, Hashable>::add(const Value& value, const Key& key) {
+    if (enabled)
+        keys.try_emplace(value, Compare(), CountingAllocator<Key>(&memory)).first->second.insert(key);
+}
+
+// removes key from under value, dropping values that no longer have any keys
+template <typename Key, typename Value, typename Compare, bool Hashable>
+void NameIndex<Key, Value, Compare, Hashable>::remove(const Value& value, const Key& key) {
+    if (!enabled)
+        return;
+    auto entry = keys.find(value);
+    if (entry == keys.end())
+        return;
+    entry->second.erase(key);
+    if (entry->second.empty())
+        keys.erase(entry);
+}
+
+// every key with the given value in ascending order. O(1 + k)
+template <typename Key, typename Value, typename Compare, bool Hashable>
+std::vector<Key> NameIndex<Key, Value, Compare, Hashable>::find(const Value& value) const {
+    std::vector<Key> result;
+    auto entry = keys.find(value);
+    if (entry != keys.end())
+        result.assign(entry->second.begin(), entry->second.end());
+    return result;
+}
+
+// drops every entry but leaves the index enabled or disabled as it was
+template <typename Key, typename Value, typename Compare, bool Hashable>
+void NameIndex<Key, Value, Compare, Hashable>::clear() {
+    keys.clear();
+}
+
+// bytes held by the containers, plus the heap buffers of the values and keys they hold copies of
+template <typename Key, typename Value, typename Compare, bool Hashable>
+size_t NameIndex<Key, Value, Compare, Hashable>::memoryUsage() const {
+    size_t total = memory.bytes();
+    for (const Entry& entry : keys) {
+        total += heapBytes(entry.first);
+        for (const Key& key : entry.second)
+            total += heapBytes(key);
+    }
+    return total;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Slab allocator for fixed-size nodes. Nodes are carved out of large blocks
+// instead of being allocated one at a time, removed nodes go on a free list so
+// the next insert reuses them, and clear() hands every block back at once.
+template <typename T>
+class NodePool {
+private:
+    // a free slot stores the pointer to the next free slot in the same memory
+    // the node used to occupy, so the free list costs no extra space
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<Slot*> blocks;
+    Slot* freeList = nullptr;
+    size_t blockSize;
+    size_t used;          // slots handed out from the newest block
+    size_t live = 0;      // nodes currently constructed
+
+public:
+    explicit NodePool(size_t slotsPerBlock = 1024);
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    template <typename... Args>
+    T* create(Args&&... args);
+    void destroy(T* node);
+    void clear();
+    size_t liveCount() const;
+    size_t capacity() const;
+    size_t liveBytes() const;
+    size_t bytes() const;
+};
+
+template <typename T>
+NodePool<T>::NodePool(size_t slotsPerBlock) {
+    blockSize = slotsPerBlock > 0 ? slotsPerBlock : 1;
+    used = blockSize; // forces the first create() to allocate a block
+}
+
+template <typename T>
+NodePool<T>::~NodePool() {
+    clear();
+}
+
+// constructs a node in a recycled slot if there is one, otherwise in the next
+// unused slot of the newest block
+template <typename T>
+template <typename... Args>
+T* NodePool<T>::create(Args&&... args) {
+    Slot* slot;
+    if (freeList != nullptr) {
+        slot = freeList;
+        freeList = freeList->next;
+    }
+    else {
+        if (used == blockSize) {
+            blocks.push_back(static_cast<Slot*>(::operator new(sizeof(Slot) * blockSize)));
+            used = 0;
+        }
+        slot = blocks.back() + used++;
+    }
+    T* node = new (slot->storage) T(std::forward<Args>(args)...);
+    live++;
+    return node;
+}
+
+// runs the node's destructor and puts its slot on the free list
+template <typename T>
+void NodePool<T>::destroy(T* node) {
+    node->~T();
+    Slot* slot = reinterpret_cast<Slot*>(node);
+    slot->next = freeList;
+    freeList = slot;
+    live--;
+}
+
+// releases every block in one pass over the block list. destructors of nodes that
+// are still live are NOT run, so owners of non-trivial nodes must destroy them first
+template <typename T>
+void NodePool<T>::clear() {
+    for (Slot* block : blocks)
+        ::operator delete(block);
+    blocks.clear();
+    freeList = nullptr;
+    used = blockSize;
+    live = 0;
+}
+
+template <typename T>
+size_t NodePool<T>::liveCount() const {
+    return live;
+}
+
+// number of slots allocated across all blocks
+template <typename T>
+size_t NodePool<T>::capacity() const {
+    return blocks.size() * blockSize;
+}
+
+// memory taken by the nodes currently constructed
+template <typename T>
+size_t NodePool<T>::liveBytes() const {
+    return live * sizeof(Slot);
+}
+
+// memory held by the pool: every block, whether its slots are in use or not, and the block list
+template <typename T>
+size_t NodePool<T>::bytes() const {
+    return capacity() * sizeof(Slot) + blocks.capacity() * sizeof(Slot*);
+}
@@ -1,242 +1,320 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "BPlusTree.h"
+#include "Journal.h"
+#include "NameIndex.h"
+#include "NodePool.h"
+#include "OutputSink.h"
+#include "Snapshot.h"
+#include "Stats.h"
 using std::string;
 using std::cout;
 using std::endl;
 using std::max;
 
+// AVL tree ordered by Key under Compare, storing one Value per key. Keys are compared with
+// compare(a, b) only, so two keys are the same when neither sorts before the other.
+// The print functions format the values as names, so they only compile when Value is a string.
+template <typename Key, typename Value, typename Compare = std::less<Key>>
 class AVL {
 private:
-    // creates TreeNode structure containing the student's name and ID,
-    // as well as left and right pointers.
+    // creates TreeNode structure containing the key and value,
+    // as well as left and right pointers. height and size cache the height and
+    // node count of the sub-tree rooted at this node so balancing and
+    // order-statistic queries never have to recurse.
     struct TreeNode {
-        string name;
-        int id;
+        Key key;
+        Value value;
+        int height;
+        unsigned int size;
         TreeNode* left;
         TreeNode* right;
-        TreeNode() { name = ""; id = 0; left = nullptr; right = nullptr; }
-        TreeNode(string studentName, int studentID) {
-            name = studentName;
-            id = studentID;
+        // the value is built in place from whatever arguments insert()/emplace() were given
+        template <typename K, typename... Args>
+        TreeNode(K&& nodeKey, Args&&... args) : key(std::forward<K>(nodeKey)), value(std::forward<Args>(args)...) {
+            height = 1;
+            size = 1;
             left = nullptr;
             right = nullptr;
         }
-        TreeNode(string studentName, int studentID, TreeNode* leftPtr, TreeNode* rightPtr) {
-            name = studentName;
-            id = studentID;
-            left = leftPtr;
-            right = rightPtr;
-        }
     };
 
+    // an AVL of n nodes is at most ~1.44 log2(n) levels tall, so a fixed-size array is
+    // always deep enough to record the path of an insert/remove for any tree that fits in memory
+    static const int MAX_HEIGHT = 64;
+
     // initializes root to be NULL inside the class
     TreeNode* root = nullptr;
     unsigned int nodeCount = 0;  // Added for part 3 testing
+    NodePool<TreeNode> pool; // every TreeNode is allocated from and returned to this pool
+    Compare compare;
+
+    NameIndex<Key, Value, Compare> nameIndex; // optional value -> keys index, only maintained while enabled
+    MAP_STAT(uint64_t rotations[4] = {};) // by TreeStats::Rotation case, only in MAP_STATS builds (see Stats.h)
 
     // main helper functions meant to be called through external functions
-    AVL::TreeNode* helperInsert(TreeNode* rootAVL, string studentName, int studentID);
-    AVL::TreeNode* helperRemove(TreeNode* rootAVL, int studentID);
-    void helperSearchID(TreeNode* rootAVL, int studentID, string& studentName);
-    void helperSearchName(TreeNode* rootAVL, string studentName, bool& check);
-    void helperInorder(TreeNode* rootAVL, TreeNode* maxTreeNode);
-    string helperPreorder(TreeNode* rootAVL, TreeNode* maxTreeNode, string traverse);
-    void helperPostorder(TreeNode* rootAVL, TreeNode* maxTreeNode);
+    template <typename... Args>
+    bool helperInsert(const Key& key, bool overwrite, Args&&... args);
+    bool helperRemove(const Key& key);
+    TreeNode* helperSearchID(const Key& key) const;
+    template <typename Visitor>
+    void helperInorder(TreeNode* rootAVL, Visitor& visit);
+    template <typename Visitor>
+    void helperPreorder(TreeNode* rootAVL, Visitor& visit);
+    template <typename Visitor>
+    void helperPostorder(TreeNode* rootAVL, Visitor& visit);
     void helperLevelCt(TreeNode* rootAVL);
-    void helperRemoveInorder(TreeNode* rootAVL, int n, int& studentID);
+    void helperDestroy(TreeNode* rootAVL);
+    TreeNode* helperBuild(std::vector<std::pair<Key, Value>>& records, size_t first, size_t last);
+    TreeNode* helperSelect(TreeNode* rootAVL, unsigned int index) const;
 
     // internal functions for rotation/finding successor/balancing
-    AVL::TreeNode* findMax(TreeNode* rootAVL);
-    AVL::TreeNode* findMin(TreeNode* rootAVL);
-    AVL::TreeNode* leftRotate(TreeNode* rootAVL);
-    AVL::TreeNode* rightRotate(TreeNode* rootAVL);
-    AVL::TreeNode* leftRight(TreeNode* rootAVL);
-    AVL::TreeNode* rightLeft(TreeNode* rootAVL);
-    int height(TreeNode* rootAVL);
+    TreeNode* findMax(TreeNode* rootAVL);
+    TreeNode* findMin(TreeNode* rootAVL);
+    TreeNode* leftRotate(TreeNode* rootAVL);
+    TreeNode* rightRotate(TreeNode* rootAVL);
+    TreeNode* leftRight(TreeNode* rootAVL);
+    TreeNode* rightLeft(TreeNode* rootAVL);
+    TreeNode* rebalance(TreeNode* rootAVL);
+    static int height(TreeNode* rootAVL);
+    static unsigned int subtreeSize(TreeNode* rootAVL);
+    static uint64_t depthSum(const TreeNode* rootAVL, uint64_t depth);
+    static void helperHeapBytes(const TreeNode* rootAVL, MemoryUsage& usage);
+    void updateNode(TreeNode* rootAVL);
     int leftRightDiff(TreeNode* rootAVL);
 
 public:
+    class Iterator;
+    using KeyType = Key;
+    using ValueType = Value;
+    using CompareType = Compare;
+
+    AVL() = default;
+    ~AVL();
+    AVL(const AVL&) = delete;
+    AVL& operator=(const AVL&) = delete;
+
     // main functions
-    bool insert(string studentName, int studentID);
-    bool remove(int studentID);
-    string searchID(int studentID);
-    void searchName(string studentName);
+    bool insert(const Key& key, const Value& value);
+    bool insert(const Key& key, Value&& value);
+    template <typename... Args>
+    bool emplace(const Key& key, Args&&... args);
+    bool upsert(const Key& key, const Value& value);
+    bool upsert(const Key& key, Value&& value);
+    bool remove(const Key& key);
+    const Value* search(const Key& key) const;
+    void searchName(const Value& value);
+    std::vector<Key> keysWithValue(const Value& value);
+    void enableNameIndex(bool enable);
     void inorderPrint();
     string preorderPrint();
+    void preorderPrint(std::ostream& out);
     void postorderPrint();
+    template <typename Visitor>
+    void visitInorder(Visitor visit);
+    template <typename Visitor>
+    void visitPreorder(Visitor visit);
+    template <typename Visitor>
+    void visitPostorder(Visitor visit);
     void levelCountPrint();
     void removeInorder(int n);
-    unsigned int getNodeCount();
-};
-
-// helper function for inserting a TreeNode into the AVL
-AVL::TreeNode* AVL::helperInsert(TreeNode* rootAVL, string studentName, int studentID) {
-    // if root node is NULL before or after iteration, create a new
-    // TreeNode that stores studentName and studentID parameters
-    if (rootAVL == nullptr)
-        return new TreeNode(studentName, studentID);
-
-    // iterates recursively until an appropriate spot is found
-    if (studentID < rootAVL->id)
-        rootAVL->left = helperInsert(rootAVL->left, studentName, studentID);
-    else if (studentID > rootAVL->id)
-        rootAVL->right = helperInsert(rootAVL->right, studentName, studentID);
-    else {
-        return rootAVL;
-    }
+    bool select(unsigned int index, Key& key) const;
+    unsigned int rank(const Key& key) const;
+    bool removeNth(unsigned int index);
+    unsigned int getNodeCount() const;
+    void clear();
+    unsigned int bulkLoad(std::vector<std::pair<Key, Value>> records);
+    void stats(TreeStats& result) const;
+    void resetStats();
+    MemoryUsage memoryUsage() const;
 
-    // balancing part of helperInsert //
-    int balanceValue = leftRightDiff(rootAVL);
+    // ordered access. iterators visit nodes in ascending key order and are invalidated by insert/remove
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lowerBound(const Key& key) const;
+    Iterator upperBound(const Key& key) const;
+    const Compare& keyCompare() const;
 
-    // left left
-    if (balanceValue > 1 && leftRightDiff(rootAVL->left) >= 0)
-        return rightRotate(rootAVL);
+    // in-order cursor. the AVL has no parent pointers, so the cursor keeps the nodes whose
+    // left sub-tree it is still inside on a fixed-size stack. the top of the stack is the current node
+    class Iterator {
+    private:
+        const TreeNode* stack[MAX_HEIGHT];
+        int depth = 0;
+        void pushLeft(const TreeNode* node);
 
-    // right right
-    if (balanceValue < -1 && leftRightDiff(rootAVL->right) <= 0)
-        return leftRotate(rootAVL);
+    public:
+        Iterator& operator++();
+        bool operator!=(Iterator const& rhs) const;
+        bool operator==(Iterator const& rhs) const;
+        std::pair<const Key&, const Value&> operator*() const;
+        const Key& key() const;
+        const Value& value() const;
+        friend class AVL;
+    };
+};
 
-    // left right
-    if (balanceValue > 1 && leftRightDiff(rootAVL->left) < 0)
-        return leftRight(rootAVL);
+// helper function for inserting a TreeNode into the AVL. descends once, recording the link
+// to every node on the way down, then walks that path back up to rebalance. if key
+// already exists its value is only replaced when overwrite is set. the value is built from args,
+// and only once it is known to be needed. returns true if the key existed
+template <typename Key, typename Value, typename Compare>
+template <typename... Args>
+bool AVL<Key, Value, Compare>::helperInsert(const Key& key, bool overwrite, Args&&... args) {
+    TreeNode** path[MAX_HEIGHT];
+    int depth = 0;
+    TreeNode** link = &this->root;
 
-    // right left
-    if (balanceValue < -1 && leftRightDiff(rootAVL->right) > 0)
-        return rightLeft(rootAVL);
+    // iterates until an empty spot is found or the key turns out to be taken
+    while (*link != nullptr) {
+        TreeNode* node = *link;
+        path[depth] = link;
+        if (compare(key, node->key))
+            link = &node->left;
+        else if (compare(node->key, key))
+            link = &node->right;
+        else {
+            if (overwrite) {
+                Value value(std::forward<Args>(args)...);
+                nameIndex.remove(node->value, key);
+                node->value = std::move(value);
+                nameIndex.add(node->value, key);
+            }
+            return true;
+        }
+        depth++;
+    }
+    *link = pool.create(key, std::forward<Args>(args)...);
+    nodeCount++;
+    nameIndex.add((*link)->value, key);
 
-    return rootAVL;
+    // balancing part of helperInsert //
+    while (depth > 0) {
+        link = path[--depth];
+        *link = rebalance(*link);
+    }
+    return false;
 }
 
-// helper function for removing a TreeNode from the AVL
-AVL::TreeNode* AVL::helperRemove(TreeNode* rootAVL, int studentID) {
-    if (rootAVL == nullptr)
-        return rootAVL;
-    else if (studentID < rootAVL->id)
-        rootAVL->left = helperRemove(rootAVL->left, studentID);
-    else if (studentID > rootAVL->id)
-        rootAVL->right = helperRemove(rootAVL->right, studentID);
-    else { // found correct ID
-        // no child case
-        if (rootAVL->left == nullptr && rootAVL->right == nullptr) {
-            return nullptr; // delete node
+// helper function for removing a TreeNode from the AVL. same single descent as helperInsert,
+// continuing down to the in-order successor in the two child case. returns false if the key was not found
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::helperRemove(const Key& key) {
+    TreeNode** path[MAX_HEIGHT];
+    int depth = 0;
+    TreeNode** link = &this->root;
+
+    while (*link != nullptr) {
+        if (compare(key, (*link)->key)) {
+            path[depth++] = link;
+            link = &(*link)->left;
         }
-        // one child case
-        else if (rootAVL->left == nullptr || rootAVL->right == nullptr) {
-            TreeNode* temp;
-            if (rootAVL->left != nullptr)
-                temp = rootAVL->left;
-            else
-                temp = rootAVL->right;
-            *rootAVL = *temp; // overwrites root with left/right child, retains left/right child data
+        else if (compare((*link)->key, key)) {
+            path[depth++] = link;
+            link = &(*link)->right;
         }
-        // two child case
-        else {
-            TreeNode* temp = findMin(rootAVL->right); // find successor: right node -> left most node
-            rootAVL->id = temp->id; // overwrite root's id and name
-            rootAVL->name = temp->name; // root still points to original left and right pointers
-            rootAVL->right = helperRemove(rootAVL->right, temp->id); // remove successor node
+        else
+            break;
+    }
+    if (*link == nullptr) // no such key exists in the AVL, meaning there is no node to remove
+        return false;
+
+    TreeNode* target = *link; // found correct key
+    nameIndex.remove(target->value, target->key);
+    // two child case
+    if (target->left != nullptr && target->right != nullptr) {
+        path[depth++] = link; // target stays in the tree but its right sub-tree shrinks
+        TreeNode** successorLink = &target->right; // find successor: right node -> left most node
+        while ((*successorLink)->left != nullptr) {
+            path[depth++] = successorLink;
+            successorLink = &(*successorLink)->left;
         }
+        TreeNode* successor = *successorLink;
+        target->key = std::move(successor->key); // overwrite target's key and value
+        target->value = std::move(successor->value);
+        *successorLink = successor->right; // successor has no left child, so unlink it like the one child case
+        pool.destroy(successor);
+    }
+    // no child and one child case: the child (or NULL) takes the removed node's place
+    else {
+        if (target->left != nullptr)
+            *link = target->left;
+        else
+            *link = target->right;
+        pool.destroy(target);
     }
+    nodeCount--;
 
     // balancing part of helperRemove //
-    int balanceValue = leftRightDiff(rootAVL);
-
-    // left left
-    if (balanceValue > 1 && leftRightDiff(rootAVL->left) >= 0)
-        return rightRotate(rootAVL);
-
-    // right right
-    if (balanceValue < -1 && leftRightDiff(rootAVL->right) <= 0)
-        return leftRotate(rootAVL);
-
-    // left right
-    if (balanceValue > 1 && leftRightDiff(rootAVL->left) < 0)
-        return leftRight(rootAVL);
-
-    // right left
-    if (balanceValue < -1 && leftRightDiff(rootAVL->right) > 0)
-        return rightLeft(rootAVL);
-
-    return rootAVL;
-}
-
-// helper function for searching for studentID in the AVL
-void AVL::helperSearchID(TreeNode* rootAVL, int studentID, string& studentName) {
-    // if root is NULL, return to original function call
-    if (rootAVL == nullptr)
-        return;
-
-    // iterates recursively through AVL by making comparisons between desired ID and root's ID
-    if (studentID < rootAVL->id)
-        helperSearchID(rootAVL->left, studentID, studentName);
-    if (studentID > rootAVL->id)
-        helperSearchID(rootAVL->right, studentID, studentName);
-    if (studentID == rootAVL->id) {
-        studentName = rootAVL->name; // stores root's name into reference variable studentName that is defined in search();
-        return;
+    while (depth > 0) {
+        link = path[--depth];
+        *link = rebalance(*link);
     }
+    return true;
 }
 
-// helper function for searching for studentName in the AVL
-void AVL::helperSearchName(TreeNode* rootAVL, string studentName, bool& check) {
-    // used in the case that helperSearchName is called to an AVL with its root equal to NULL
-    if (rootAVL == nullptr && !check) {
-        cout << "unsuccessful" << endl;
-        return;
+// helper function for searching for key in the AVL. returns NULL if it is not found
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::helperSearchID(const Key& key) const {
+    TreeNode* rootAVL = this->root;
+    // iterates through AVL by making comparisons between desired key and root's key
+    while (rootAVL != nullptr) {
+        if (compare(key, rootAVL->key))
+            rootAVL = rootAVL->left;
+        else if (compare(rootAVL->key, key))
+            rootAVL = rootAVL->right;
+        else
+            break;
     }
-    check = true; // after checking the root, boolean variable check is set to true for the rest of the function call
-
-    // if root is NULL, return to original function call
-    if (rootAVL == nullptr)
-        return;
-
-    // because student names are not unique, continue iterating through the entire AVL to find each instance of studentName
-    if (studentName == rootAVL->name)
-        cout << rootAVL->id << endl; // print student's ID
-    helperSearchName(rootAVL->left, studentName, check);
-    helperSearchName(rootAVL->right, studentName, check);
+    return rootAVL;
 }
 
-// helper function for printing the AVL in-order
-void AVL::helperInorder(TreeNode* rootAVL, TreeNode* maxTreeNode) {
+// helper function for visiting the AVL in-order. visit is called with each node's key and value
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::helperInorder(TreeNode* rootAVL, Visitor& visit) {
     // if root is NULL, return to original function call
     if (rootAVL == nullptr)
         return;
-    helperInorder(rootAVL->left, maxTreeNode); // keep iterating left until NULL
-    cout << rootAVL->name;  // once NULL is reached, print the student's name
-    if (rootAVL != maxTreeNode) // used to format the output. maxTreeNode refers to the largest node in the tree
-        cout << ", ";
-    helperInorder(rootAVL->right, maxTreeNode); // iterate right once unless NULL
+    helperInorder(rootAVL->left, visit); // keep iterating left until NULL
+    visit(rootAVL->key, rootAVL->value);
+    helperInorder(rootAVL->right, visit); // iterate right once unless NULL
 }
 
-// helper function for printing the AVL in pre-order
-string AVL::helperPreorder(TreeNode* rootAVL, TreeNode* maxTreeNode, string traverse) {
-    // FIXED: Preorder traversal doesn't always end with the largest node if it has left children.
-    TreeNode* leftChild = findMin(maxTreeNode);
-    // if root is NULL, return to original function call
+// helper function for visiting the AVL in pre-order
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::helperPreorder(TreeNode* rootAVL, Visitor& visit) {
     if (rootAVL == nullptr)
-        return traverse;
-    traverse += rootAVL->name;
-    if (rootAVL != leftChild) // used to format the output. maxTreeNode refers to the largest node in the tree
-        traverse += ", ";
-    traverse = helperPreorder(rootAVL->left, maxTreeNode, traverse); // iterate left once unless NULL
-    traverse = helperPreorder(rootAVL->right, maxTreeNode, traverse); // iterate right once unless NULL
-    return traverse;
+        return;
+    visit(rootAVL->key, rootAVL->value);
+    helperPreorder(rootAVL->left, visit); // iterate left once unless NULL
+    helperPreorder(rootAVL->right, visit); // iterate right once unless NULL
 }
 
-// helper function for printing the AVL in post-order
-void AVL::helperPostorder(TreeNode* rootAVL, TreeNode* maxTreeNode) {
-    // if root is NULL, return to original function call
+// helper function for visiting the AVL in post-order
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::helperPostorder(TreeNode* rootAVL, Visitor& visit) {
     if (rootAVL == nullptr)
         return;
-    helperPostorder(rootAVL->left, maxTreeNode); // keep iterating left until NULL
-    helperPostorder(rootAVL->right, maxTreeNode); // iterate right once unless NULL
-    cout << rootAVL->name; // print student's name
-    if (rootAVL != maxTreeNode) // used to format the output. maxTreeNode refers to the largest node in the tree
-        cout << ", ";
+    helperPostorder(rootAVL->left, visit); // keep iterating left until NULL
+    helperPostorder(rootAVL->right, visit); // iterate right once unless NULL
+    visit(rootAVL->key, rootAVL->value);
 }
 
 // helper function for printing the AVL's level count
-void AVL::helperLevelCt(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::helperLevelCt(TreeNode* rootAVL) {
     int h = height(rootAVL); // calls the height function
     if (rootAVL == nullptr) // if root is NULL, level count is 0
         cout << "0" << endl;
@@ -244,21 +322,54 @@ void AVL::helperLevelCt(TreeNode* rootAVL) {
         cout << h << endl;
 }
 
-// helper function for removing AVL nodes in-order
-void AVL::helperRemoveInorder(TreeNode* rootAVL, int n, int& studentID) {
-    static int count = 0; // count is only initialized once when called, meaning it will not change in recursive calls
-    // iterates recursively in-order until count == n
-    if (rootAVL != nullptr && count < n) {
-        helperRemoveInorder(rootAVL->left, n, studentID);
-        count++;
-        if (count == n)
-            studentID = rootAVL->id; // if count == n, stores root's name into reference variable studentName that is defined in removeInorder();
-        helperRemoveInorder(rootAVL->right, n, studentID);
+// helper function for running the destructor of every node in the AVL (post-order)
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::helperDestroy(TreeNode* rootAVL) {
+    if (rootAVL == nullptr)
+        return;
+    helperDestroy(rootAVL->left);
+    helperDestroy(rootAVL->right);
+    rootAVL->~TreeNode(); // memory is returned in bulk by pool.clear()
+}
+
+// helper function for building a perfectly balanced AVL out of records[first, last), which must
+// be sorted by key with no duplicates. the middle record becomes the root of each sub-tree
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::helperBuild(std::vector<std::pair<Key, Value>>& records, size_t first, size_t last) {
+    if (first >= last)
+        return nullptr;
+    size_t middle = first + (last - first) / 2;
+    TreeNode* leftChild = helperBuild(records, first, middle);
+    TreeNode* rightChild = helperBuild(records, middle + 1, last);
+    nameIndex.add(records[middle].second, records[middle].first);
+    TreeNode* node = pool.create(std::move(records[middle].first), std::move(records[middle].second));
+    node->left = leftChild;
+    node->right = rightChild;
+    updateNode(node);
+    return node;
+}
+
+// helper function for finding the node at a 0-based in-order position.
+// sub-tree sizes tell us which side the position is on, so this is O(log n)
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::helperSelect(TreeNode* rootAVL, unsigned int index) const {
+    while (rootAVL != nullptr) {
+        unsigned int leftSize = subtreeSize(rootAVL->left);
+        if (index < leftSize) // position is inside the left sub-tree
+            rootAVL = rootAVL->left;
+        else if (index > leftSize) { // skip the left sub-tree and this node
+            index -= leftSize + 1;
+            rootAVL = rootAVL->right;
+        }
+        else
+            return rootAVL;
     }
+    return nullptr; // index is past the last node
 }
 
 // function used to find the right-most node from the called parameter
-AVL::TreeNode* AVL::findMax(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::findMax(TreeNode* rootAVL) {
     if (rootAVL == nullptr)
         return rootAVL;
     while (rootAVL->right != nullptr) // continue iterating until root->right is NULL
@@ -267,7 +378,8 @@ AVL::TreeNode* AVL::findMax(TreeNode* rootAVL) {
 }
 
 // function used to find the left-most node from the called parameter
-AVL::TreeNode* AVL::findMin(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::findMin(TreeNode* rootAVL) {
     if (rootAVL == nullptr)
         return rootAVL;
     while (rootAVL->left != nullptr) // continue iterating until root->left is NULL
@@ -277,175 +389,1161 @@ AVL::TreeNode* AVL::findMin(TreeNode* rootAVL) {
 
 // code from Aman
 // rotate function used in right-right, left-right, and right-left, cases
-AVL::TreeNode* AVL::leftRotate(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::leftRotate(TreeNode* rootAVL) {
     TreeNode* grandchild = rootAVL->right->left;
     TreeNode* newParent = rootAVL->right;
     newParent->left = rootAVL;
     rootAVL->right = grandchild;
+    updateNode(rootAVL); // old root is now the child, so it has to be updated first
+    updateNode(newParent);
     return newParent;
 }
 
 // code from Aman
 // rotate function used in left-left, right-left, and left-right, cases
-AVL::TreeNode* AVL::rightRotate(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::rightRotate(TreeNode* rootAVL) {
     TreeNode* grandchild = rootAVL->left->right;
     TreeNode* newParent = rootAVL->left;
     newParent->right = rootAVL;
     rootAVL->left = grandchild;
+    updateNode(rootAVL); // old root is now the child, so it has to be updated first
+    updateNode(newParent);
     return newParent;
 }
 
 // rotation function for left-right cases
-AVL::TreeNode* AVL::leftRight(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::leftRight(TreeNode* rootAVL) {
     rootAVL->left = leftRotate(rootAVL->left);
     return rightRotate(rootAVL);
 }
 
 // rotation function for right-left cases
-AVL::TreeNode* AVL::rightLeft(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::rightLeft(TreeNode* rootAVL) {
     rootAVL->right = rightRotate(rootAVL->right);
     return leftRotate(rootAVL);
 }
 
-// function that is used in calculating the balance factor, and level count
-int AVL::height(TreeNode* rootAVL) {
-    int h = 0; // height is initialized as 0
-    if (rootAVL != nullptr) {
-        int leftHeight = height(rootAVL->left); // finds height of left sub-tree
-        int rightHeight = height(rootAVL->right); // finds height of right sub-tree
-        h = max(leftHeight, rightHeight) + 1; // sets height as the height of the greater of the two sub-trees + 1
+// refreshes a node whose sub-trees have changed and applies whichever rotation
+// restores the AVL property. returns the new root of the sub-tree
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::TreeNode* AVL<Key, Value, Compare>::rebalance(TreeNode* rootAVL) {
+    updateNode(rootAVL);
+    int balanceValue = leftRightDiff(rootAVL);
+
+    // left left
+    if (balanceValue > 1 && leftRightDiff(rootAVL->left) >= 0) {
+        MAP_STAT(rotations[TreeStats::LL]++;)
+        return rightRotate(rootAVL);
+    }
+
+    // right right
+    if (balanceValue < -1 && leftRightDiff(rootAVL->right) <= 0) {
+        MAP_STAT(rotations[TreeStats::RR]++;)
+        return leftRotate(rootAVL);
+    }
+
+    // left right
+    if (balanceValue > 1 && leftRightDiff(rootAVL->left) < 0) {
+        MAP_STAT(rotations[TreeStats::LR]++;)
+        return leftRight(rootAVL);
     }
-    return h; // returns height
+
+    // right left
+    if (balanceValue < -1 && leftRightDiff(rootAVL->right) > 0) {
+        MAP_STAT(rotations[TreeStats::RL]++;)
+        return rightLeft(rootAVL);
+    }
+
+    return rootAVL;
+}
+
+// function that is used in calculating the balance factor, and level count
+template <typename Key, typename Value, typename Compare>
+int AVL<Key, Value, Compare>::height(TreeNode* rootAVL) {
+    if (rootAVL == nullptr) // an empty sub-tree has height 0
+        return 0;
+    return rootAVL->height; // height is cached in the node, so this is O(1)
+}
+
+// function that returns the number of nodes in a sub-tree in O(1)
+template <typename Key, typename Value, typename Compare>
+unsigned int AVL<Key, Value, Compare>::subtreeSize(TreeNode* rootAVL) {
+    if (rootAVL == nullptr)
+        return 0;
+    return rootAVL->size;
+}
+
+// sum of the depths of every node in a sub-tree whose root is at depth. recursion is fine here,
+// since an AVL is never more than ~1.44 log2(n) levels deep
+template <typename Key, typename Value, typename Compare>
+uint64_t AVL<Key, Value, Compare>::depthSum(const TreeNode* rootAVL, uint64_t depth) {
+    if (rootAVL == nullptr)
+        return 0;
+    return depth + depthSum(rootAVL->left, depth + 1) + depthSum(rootAVL->right, depth + 1);
+}
+
+// recomputes a node's cached height and size from its children. must be called bottom-up
+// whenever a node's children change (after an insert/remove below it, or a rotation)
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::updateNode(TreeNode* rootAVL) {
+    rootAVL->height = max(height(rootAVL->left), height(rootAVL->right)) + 1;
+    rootAVL->size = subtreeSize(rootAVL->left) + subtreeSize(rootAVL->right) + 1;
 }
 
 // function that calculates the balance factor of a given node
-int AVL::leftRightDiff(TreeNode* rootAVL) {
+template <typename Key, typename Value, typename Compare>
+int AVL<Key, Value, Compare>::leftRightDiff(TreeNode* rootAVL) {
     int leftHeight = height(rootAVL->left); // finds height of the left sub-tree
     int rightHeight = height(rootAVL->right); // finds height of the right sub-tree
     int balanceFactor = leftHeight - rightHeight; // subtracts left height from right height
     return balanceFactor;
 }
 
-// public function that calls helper function helperInsert()
-bool AVL::insert(string studentName, int studentID) {
-    string name = "";
-    helperSearchID(this->root, studentID, name); // checks if studentID is already initialized in AVL
-    if (name.compare("") != 0) // if an ID is found, name will be some arbitrary string, meaning this operation cannot be executed
-        return false;
-    else { // if name is an empty string, the studentID is unique
-        this->root = helperInsert(this->root, studentName, studentID);
-        nodeCount++;
-        return true;
+template <typename Key, typename Value, typename Compare>
+AVL<Key, Value, Compare>::~AVL() {
+    clear();
+}
+
+// public function that removes every node. node memory is released a whole block at a time,
+// and the destructor pass is skipped entirely when TreeNode has nothing to destroy
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::clear() {
+    if (!std::is_trivially_destructible<TreeNode>::value)
+        helperDestroy(this->root);
+    pool.clear();
+    nameIndex.clear();
+    this->root = nullptr;
+    nodeCount = 0;
+}
+
+// public function that loads many (key, value) records at once. records are sorted only if they are not
+// sorted already, then merged with the current contents and rebuilt into a balanced AVL in O(n).
+// like insert(), a key that is already in the AVL (or repeated in records) keeps its first value.
+// returns the number of keys that were added
+template <typename Key, typename Value, typename Compare>
+unsigned int AVL<Key, Value, Compare>::bulkLoad(std::vector<std::pair<Key, Value>> records) {
+    using Record = std::pair<Key, Value>;
+    auto byKey = [this](const Record& a, const Record& b) { return compare(a.first, b.first); };
+    if (!std::is_sorted(records.begin(), records.end(), byKey))
+        std::stable_sort(records.begin(), records.end(), byKey); // stable, so the first of any duplicates stays first
+    auto sameKey = [this](const Record& a, const Record& b) { return !compare(a.first, b.first); }; // a <= b once sorted
+    records.erase(std::unique(records.begin(), records.end(), sameKey), records.end());
+
+    unsigned int previousCount = nodeCount;
+    if (this->root != nullptr) {
+        // merge with what is already in the AVL. existing entries are listed first so they win ties
+        std::vector<Record> current;
+        current.reserve(nodeCount);
+        visitInorder([&](Key& key, Value& value) { current.emplace_back(std::move(key), std::move(value)); });
+        std::vector<Record> merged;
+        merged.reserve(current.size() + records.size());
+        std::merge(std::make_move_iterator(current.begin()), std::make_move_iterator(current.end()),
+            std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()),
+            std::back_inserter(merged), byKey);
+        merged.erase(std::unique(merged.begin(), merged.end(), sameKey), merged.end());
+        records.swap(merged);
     }
+
+    clear();
+    this->root = helperBuild(records, 0, records.size());
+    nodeCount = (unsigned int)records.size();
+    return nodeCount - previousCount;
+}
+
+// public function that calls helper function helperInsert(). returns false if key is already in the AVL
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::insert(const Key& key, const Value& value) {
+    return !helperInsert(key, false, value);
+}
+
+// same as above, but the value is moved into the new node instead of copied
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::insert(const Key& key, Value&& value) {
+    return !helperInsert(key, false, std::move(value));
+}
+
+// public function that inserts key with a value constructed in place from args. nothing is
+// constructed if key is already in the AVL. returns false in that case
+template <typename Key, typename Value, typename Compare>
+template <typename... Args>
+bool AVL<Key, Value, Compare>::emplace(const Key& key, Args&&... args) {
+    return !helperInsert(key, false, std::forward<Args>(args)...);
+}
+
+// public function that inserts key, or replaces its value if it already exists.
+// returns true if key already existed
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::upsert(const Key& key, const Value& value) {
+    return helperInsert(key, true, value);
+}
+
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::upsert(const Key& key, Value&& value) {
+    return helperInsert(key, true, std::move(value));
 }
 
 // public function that calls helper function helperRemove()
-bool AVL::remove(int studentID) {
-    string name = "";
-    helperSearchID(this->root, studentID, name); // checks if studentID is already initialized in AVL
-    if (name.compare("") == 0) // if name is an empty string, no such ID exists in the AVL, meaning there is no node to remove
-        return false;
-    else { // if name has some arbitrary string, the studentID exists in AVL
-        this->root = helperRemove(this->root, studentID);
-        nodeCount--;
-        return true;
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::remove(const Key& key) {
+    return helperRemove(key);
+}
+
+// public function that calls helper function helperSearchID(). returns NULL if key is not in the AVL
+template <typename Key, typename Value, typename Compare>
+const Value* AVL<Key, Value, Compare>::search(const Key& key) const {
+    TreeNode* node = helperSearchID(key);
+    if (node == nullptr) // no such key exists in the AVL
+        return nullptr;
+    else
+        return &node->value;
+}
+
+// public function that prints every key whose value is value, one per line
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::searchName(const Value& value) {
+    std::vector<Key> keys = keysWithValue(value);
+    if (keys.empty()) {
+        cout << "unsuccessful" << endl;
+        return;
+    }
+    OutputSink out(cout);
+    for (const Key& key : keys) {
+        out.write(key); // print student's ID
+        out.write('\n');
     }
 }
 
-// public function that calls helper function helperSearchID()
-string AVL::searchID(int studentID) {
-    string name = "";
-    helperSearchID(this->root, studentID, name); // checks if studentID is already initialized in AVL
-    if (name.compare("") == 0) // if name is an empty string, no such ID exists in the AVL
-        return "";
-    else // if name has some arbitrary string, the studentID exists in AVL
-        return name;
+// public function that returns every key whose value is value in ascending order.
+// O(1 + k) with the name index enabled, otherwise a full scan since values are not unique
+template <typename Key, typename Value, typename Compare>
+std::vector<Key> AVL<Key, Value, Compare>::keysWithValue(const Value& value) {
+    if (nameIndex.isEnabled())
+        return nameIndex.find(value);
+    std::vector<Key> keys;
+    visitInorder([&](const Key& key, const Value& nodeValue) {
+        if (nodeValue == value)
+            keys.push_back(key);
+    });
+    return keys;
+}
+
+// public function that turns the name index on (building it from the current AVL) or off (freeing it)
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::enableNameIndex(bool enable) {
+    nameIndex.setEnabled(enable);
+    if (enable)
+        visitInorder([&](const Key& key, const Value& value) { nameIndex.add(value, key); });
+}
+
+// public function that prints every name in-order, separated by commas
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::inorderPrint() {
+    OutputSink out(cout);
+    bool first = true;
+    visitInorder([&](const Key&, const Value& name) {
+        if (!first) // used to format the output. every name but the first is preceded by a comma
+            out.write(", ", 2);
+        out.write(name);
+        first = false;
+    });
+    out.write('\n');
+}
+
+// public function that returns every name in pre-order, separated by commas
+template <typename Key, typename Value, typename Compare>
+string AVL<Key, Value, Compare>::preorderPrint() {
+    string traverse;
+    bool first = true;
+    visitPreorder([&](const Key&, const Value& name) {
+        if (!first)
+            traverse += ", ";
+        traverse += name;
+        first = false;
+    });
+    return traverse;
+}
+
+// public function that streams the same text as preorderPrint() to out without building it in memory
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::preorderPrint(std::ostream& out) {
+    OutputSink sink(out);
+    bool first = true;
+    visitPreorder([&](const Key&, const Value& name) {
+        if (!first)
+            sink.write(", ", 2);
+        sink.write(name);
+        first = false;
+    });
 }
 
-// public function that calls helper function helperSearchName()
-void AVL::searchName(string studentName) {
-    bool iter = false; // have you iterated past first node
-    helperSearchName(this->root, studentName, iter);
+// public function that prints every name in post-order, separated by commas
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::postorderPrint() {
+    OutputSink out(cout);
+    bool first = true;
+    visitPostorder([&](const Key&, const Value& name) {
+        if (!first)
+            out.write(", ", 2);
+        out.write(name);
+        first = false;
+    });
+    out.write('\n');
 }
 
-// public function that calls helper function helperInorder()
-void AVL::inorderPrint() {
-    helperInorder(this->root, findMax(this->root)); // second parameter is used to determine if the entire AVL has been reached
-    cout << endl;
+// public functions that call visit(key, value) for every node in the given order without copying anything
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::visitInorder(Visitor visit) {
+    helperInorder(this->root, visit);
 }
 
-// public function that calls helper function helperPreorder()
-string AVL::preorderPrint() {
-    return helperPreorder(this->root, findMax(this->root), ""); // second parameter is used to determine if the entire AVL has been reached
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::visitPreorder(Visitor visit) {
+    helperPreorder(this->root, visit);
 }
 
-// public function that calls helper function helperPostorder()
-void AVL::postorderPrint() {
-    helperPostorder(this->root, this->root); // second parameter is used to determine if the post-order traversal has finally reached the root node
-    cout << endl;
+template <typename Key, typename Value, typename Compare>
+template <typename Visitor>
+void AVL<Key, Value, Compare>::visitPostorder(Visitor visit) {
+    helperPostorder(this->root, visit);
 }
 
 // public function that calls helper function helperLevelCt()
-void AVL::levelCountPrint() {
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::levelCountPrint() {
     helperLevelCt(this->root);
 }
 
-// public function that calls helper functions helperRemoveInorder() and helperRemove()
-void AVL::removeInorder(int n) {
-    int stuID = 0;
-    int plusOne = n + 1; // because the helperRemoveInorder function begins counting at 1, we add 1 to the original parameter
-    helperRemoveInorder(this->root, plusOne, stuID); // stores nth in-order node ID into stuID
-    if (stuID == 0) // if stuID is not modified, it means there exists no nth ID
-        cout << "unsuccessful" << endl;
-    else { // else, it is stored with the desired nth ID, and it is removed using the helperRemove() function
-        this->root = helperRemove(this->root, stuID);
+// public function that calls removeNth() and prints the result
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::removeInorder(int n) {
+    if (n >= 0 && removeNth(n))
         cout << "successful" << endl;
+    else // there exists no nth ID
+        cout << "unsuccessful" << endl;
+}
+
+// public function that calls helper function helperSelect(). stores the key at
+// 0-based in-order position index into key, or returns false if there is none
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::select(unsigned int index, Key& key) const {
+    TreeNode* node = helperSelect(this->root, index);
+    if (node == nullptr)
+        return false;
+    key = node->key;
+    return true;
+}
+
+// public function that returns how many keys in the AVL are smaller than key
+template <typename Key, typename Value, typename Compare>
+unsigned int AVL<Key, Value, Compare>::rank(const Key& key) const {
+    unsigned int count = 0;
+    TreeNode* rootAVL = this->root;
+    while (rootAVL != nullptr) {
+        if (!compare(rootAVL->key, key))
+            rootAVL = rootAVL->left;
+        else { // this node and its whole left sub-tree are smaller
+            count += subtreeSize(rootAVL->left) + 1;
+            rootAVL = rootAVL->right;
+        }
     }
+    return count;
+}
+
+// public function that removes the node at 0-based in-order position index
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::removeNth(unsigned int index) {
+    Key key{};
+    if (!select(index, key))
+        return false;
+    return remove(key);
+}
+
+// returns a cursor at the smallest key in the AVL
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::Iterator AVL<Key, Value, Compare>::begin() const {
+    Iterator iter;
+    iter.pushLeft(this->root);
+    return iter;
+}
 
+// returns the past-the-end cursor, which has an empty stack
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::Iterator AVL<Key, Value, Compare>::end() const {
+    return Iterator();
 }
 
-unsigned int AVL::getNodeCount() {
+// returns a cursor at the first key that is not less than key. every node where the
+// search turns left is still ahead of the cursor, so only those are pushed. O(log n)
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::Iterator AVL<Key, Value, Compare>::lowerBound(const Key& key) const {
+    Iterator iter;
+    TreeNode* rootAVL = this->root;
+    while (rootAVL != nullptr) {
+        if (!compare(rootAVL->key, key)) {
+            iter.stack[iter.depth++] = rootAVL;
+            rootAVL = rootAVL->left;
+        }
+        else
+            rootAVL = rootAVL->right;
+    }
+    return iter;
+}
+
+// returns a cursor at the first key that is greater than key
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::Iterator AVL<Key, Value, Compare>::upperBound(const Key& key) const {
+    Iterator iter;
+    TreeNode* rootAVL = this->root;
+    while (rootAVL != nullptr) {
+        if (compare(key, rootAVL->key)) {
+            iter.stack[iter.depth++] = rootAVL;
+            rootAVL = rootAVL->left;
+        }
+        else
+            rootAVL = rootAVL->right;
+    }
+    return iter;
+}
+
+// the comparator the tree orders its keys with
+template <typename Key, typename Value, typename Compare>
+const Compare& AVL<Key, Value, Compare>::keyCompare() const {
+    return compare;
+}
+
+template <typename Key, typename Value, typename Compare>
+unsigned int AVL<Key, Value, Compare>::getNodeCount() const {
     return nodeCount;
 }
 
-class OrderedMap {
+// fills in the tree's part of a TreeStats: its shape, and in MAP_STATS builds the rotation counts.
+// a search visits every node from the root down to its key's, so the average depth of the nodes
+// is the cost of an average successful search
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::stats(TreeStats& result) const {
+    MAP_STAT(std::copy(rotations, rotations + 4, result.rotations);)
+    result.entries = nodeCount;
+    result.height = height(this->root);
+    result.averageDepth = nodeCount > 0 ? (double)depthSum(this->root, 1) / nodeCount : 0;
+}
+
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::resetStats() {
+    MAP_STAT(std::fill(rotations, rotations + 4, 0);)
+}
+
+// memory held by the tree. keys and values live inside the pooled nodes, so they only add
+// whatever heap buffers they own. nodes freed by remove() stay in the pool for reuse until clear()
+template <typename Key, typename Value, typename Compare>
+MemoryUsage AVL<Key, Value, Compare>::memoryUsage() const {
+    MemoryUsage usage;
+    usage.nodes = pool.liveBytes();
+    usage.freeNodes = pool.bytes() - usage.nodes;
+    usage.index = nameIndex.memoryUsage();
+    usage.other = sizeof(*this);
+    helperHeapBytes(this->root, usage);
+    return usage;
+}
+
+// adds the heap buffers owned by the keys and values of a sub-tree
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::helperHeapBytes(const TreeNode* rootAVL, MemoryUsage& usage) {
+    if (rootAVL == nullptr)
+        return;
+    usage.keys += heapBytes(rootAVL->key);
+    usage.values += heapBytes(rootAVL->value);
+    helperHeapBytes(rootAVL->left, usage);
+    helperHeapBytes(rootAVL->right, usage);
+}
+
+// pushes node and its chain of left children, leaving the smallest of them on top
+template <typename Key, typename Value, typename Compare>
+void AVL<Key, Value, Compare>::Iterator::pushLeft(const TreeNode* node) {
+    while (node != nullptr) {
+        stack[depth++] = node;
+        node = node->left;
+    }
+}
+
+// moves to the next key in ascending order in amortized O(1)
+template <typename Key, typename Value, typename Compare>
+typename AVL<Key, Value, Compare>::Iterator& AVL<Key, Value, Compare>::Iterator::operator++() {
+    const TreeNode* current = stack[--depth];
+    pushLeft(current->right); // the successor is the smallest node of the right sub-tree, if there is one
+    return *this;
+}
+
+// two cursors are equal when they are at the same node (or both past the end)
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::Iterator::operator!=(Iterator const& rhs) const {
+    return !(*this == rhs);
+}
+
+template <typename Key, typename Value, typename Compare>
+bool AVL<Key, Value, Compare>::Iterator::operator==(Iterator const& rhs) const {
+    const TreeNode* lhsNode = depth > 0 ? stack[depth - 1] : nullptr;
+    const TreeNode* rhsNode = rhs.depth > 0 ? rhs.stack[rhs.depth - 1] : nullptr;
+    return lhsNode == rhsNode;
+}
+
+template <typename Key, typename Value, typename Compare>
+std::pair<const Key&, const Value&> AVL<Key, Value, Compare>::Iterator::operator*() const {
+    return std::pair<const Key&, const Value&>(key(), value());
+}
+
+template <typename Key, typename Value, typename Compare>
+const Key& AVL<Key, Value, Compare>::Iterator::key() const {
+    return stack[depth - 1]->key;
+}
+
+template <typename Key, typename Value, typename Compare>
+const Value& AVL<Key, Value, Compare>::Iterator::value() const {
+    return stack[depth - 1]->value;
+}
+
+// ordered map from Key to Value. Tree is the backend that stores the entries, either
+// AVL or BPlusTree over the same Key, Value and Compare. both expose the same functions,
+// so the backend can be swapped without changing any caller (see the OrderedMap and
+// BPlusOrderedMap aliases below)
+template <typename Tree>
+class BasicOrderedMap {
 private:
-    AVL avlTree;
+    Tree tree;
+    std::unique_ptr<Journal> journal; // only set while journaling
+    MAP_STAT(mutable TreeStats counters;) // operation latencies, only in MAP_STATS builds (see Stats.h)
+
+    void replay(const string& segment);
+    static bool compactJournal(const string& snapshot, const std::vector<string>& segments);
 
 public:
-    OrderedMap();
-    ~OrderedMap();
-    bool insert(const string ID, const string NAME);
-    string search(const string ID);
+    using Key = typename Tree::KeyType;
+    using Value = typename Tree::ValueType;
+    using Compare = typename Tree::CompareType;
+    using Iterator = typename Tree::Iterator;
+
+    // identifies snapshots written by save()
+    static constexpr char SNAPSHOT_MAGIC[4] = { 'G', 'M', 'O', 'M' };
+    static const uint32_t SNAPSHOT_VERSION = 1;
+
+    // a pair of iterators that can be used in a range-based for loop
+    struct Range {
+        Iterator first;
+        Iterator last;
+        Iterator begin() const { return first; }
+        Iterator end() const { return last; }
+    };
+
+    BasicOrderedMap();
+    ~BasicOrderedMap();
+    bool insert(const Key& key, const Value& value);
+    bool insert(const Key& key, Value&& value);
+    template <typename... Args>
+    bool emplace(const Key& key, Args&&... args);
+    bool upsert(const Key& key, const Value& value);
+    bool upsert(const Key& key, Value&& value);
+    const Value* search(const Key& key) const;
+    bool contains(const Key& key) const;
     string traverse();
-    bool remove(const string ID);
-    unsigned int size();
+    void traverse(std::ostream& out);
+    std::vector<Key> searchValue(const Value& value);
+    void indexValues(bool enable);
+    template <typename Visitor>
+    void forEach(Visitor visit);
+    bool remove(const Key& key);
+    bool select(unsigned int index, Key& key) const;
+    unsigned int rank(const Key& key) const;
+    bool removeAt(unsigned int index);
+    unsigned int size() const;
+    void clear();
+    unsigned int bulkLoad(std::vector<std::pair<Key, Value>> records);
+    bool save(const string& path) const;
+    bool load(const string& path);
+    bool openJournal(const string& base, const JournalOptions& options = JournalOptions());
+    void closeJournal();
+    void syncJournal();
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lower_bound(const Key& key) const;
+    Iterator upper_bound(const Key& key) const;
+    Range range(const Key& lo, const Key& hi) const;
+    TreeStats stats() const;
+    void resetStats();
+    MemoryUsage memoryUsage() const;
 };
 
-OrderedMap::OrderedMap() {
+template <typename Tree>
+BasicOrderedMap<Tree>::BasicOrderedMap() {
     // Root node is already initialized to nullptr upon declaration in peer's code.
 }
 
-OrderedMap::~OrderedMap() {
+template <typename Tree>
+BasicOrderedMap<Tree>::~BasicOrderedMap() {
+    // tree's destructor hands every node back to its pool
+}
+
+template <typename Tree>
+bool BasicOrderedMap<Tree>::insert(const Key& key, const Value& value) {
+    MAP_STAT(StatTimer timer(counters.insertNs);)
+    if (!tree.insert(key, value))
+        return false;
+    if (journal)
+        journal->append(Journal::INSERT, key, value);
+    return true;
+}
+
+// moves value into the map instead of copying it
+template <typename Tree>
+bool BasicOrderedMap<Tree>::insert(const Key& key, Value&& value) {
+    MAP_STAT(StatTimer timer(counters.insertNs);)
+    if (journal) {
+        // logged first, since the tree takes value, so a key that is already there is ruled out up front
+        if (tree.search(key))
+            return false;
+        journal->append(Journal::INSERT, key, value);
+    }
+    return tree.insert(key, std::move(value));
+}
+
+// inserts key with a value constructed in place from args. if key is already in the map nothing
+// is constructed and false is returned
+template <typename Tree>
+template <typename... Args>
+bool BasicOrderedMap<Tree>::emplace(const Key& key, Args&&... args) {
+    MAP_STAT(StatTimer timer(counters.insertNs);)
+    if (!tree.emplace(key, std::forward<Args>(args)...))
+        return false;
+    if (journal)
+        journal->append(Journal::PUT, key, *tree.search(key));
+    return true;
+}
+
+// inserts key, or replaces its value if it already exists. returns true if key already existed
+template <typename Tree>
+bool BasicOrderedMap<Tree>::upsert(const Key& key, const Value& value) {
+    MAP_STAT(StatTimer timer(counters.insertNs);)
+    if (journal)
+        journal->append(Journal::PUT, key, value);
+    return tree.upsert(key, value);
+}
+
+template <typename Tree>
+bool BasicOrderedMap<Tree>::upsert(const Key& key, Value&& value) {
+    MAP_STAT(StatTimer timer(counters.insertNs);)
+    if (journal)
+        journal->append(Journal::PUT, key, value);
+    return tree.upsert(key, std::move(value));
+}
+
+// returns the value stored under key, or NULL if there is none. the pointer stays valid until the next insert/remove
+template <typename Tree>
+const typename BasicOrderedMap<Tree>::Value* BasicOrderedMap<Tree>::search(const Key& key) const {
+    MAP_STAT(StatTimer timer(counters.searchNs);)
+    return tree.search(key);
+}
+
+template <typename Tree>
+bool BasicOrderedMap<Tree>::contains(const Key& key) const {
+    MAP_STAT(StatTimer timer(counters.searchNs);)
+    return tree.search(key) != nullptr;
+}
+
+// every value separated by commas. only available when Value is a string
+template <typename Tree>
+string BasicOrderedMap<Tree>::traverse() {
+    return tree.preorderPrint();
+}
+
+// returns every key whose value is value in ascending order
+template <typename Tree>
+std::vector<typename BasicOrderedMap<Tree>::Key> BasicOrderedMap<Tree>::searchValue(const Value& value) {
+    return tree.keysWithValue(value);
+}
+
+// keeps a secondary value -> keys index so searchValue() no longer scans the whole map
+template <typename Tree>
+void BasicOrderedMap<Tree>::indexValues(bool enable) {
+    tree.enableNameIndex(enable);
+}
+
+// writes the same text as traverse() straight to out, for maps too large to hold as one string
+template <typename Tree>
+void BasicOrderedMap<Tree>::traverse(std::ostream& out) {
+    tree.preorderPrint(out);
+}
+
+// calls visit(key, value) for every entry in key order
+template <typename Tree>
+template <typename Visitor>
+void BasicOrderedMap<Tree>::forEach(Visitor visit) {
+    tree.visitInorder(visit);
+}
+
+template <typename Tree>
+bool BasicOrderedMap<Tree>::remove(const Key& key) {
+    MAP_STAT(StatTimer timer(counters.removeNs);)
+    if (!tree.remove(key))
+        return false;
+    if (journal)
+        journal->append(Journal::REMOVE, key);
+    return true;
+}
+
+// stores the key at 0-based position index in sorted order into key, or returns false if index is out of range
+template <typename Tree>
+bool BasicOrderedMap<Tree>::select(unsigned int index, Key& key) const {
+    return tree.select(index, key);
+}
+
+// returns the number of keys in the map that sort before key
+template <typename Tree>
+unsigned int BasicOrderedMap<Tree>::rank(const Key& key) const {
+    return tree.rank(key);
+}
+
+// removes the entry at 0-based position index in sorted order
+template <typename Tree>
+bool BasicOrderedMap<Tree>::removeAt(unsigned int index) {
+    if (journal) {
+        Key key;
+        return tree.select(index, key) && remove(key);
+    }
+    MAP_STAT(StatTimer timer(counters.removeNs);)
+    return tree.removeNth(index);
+}
+
+template <typename Tree>
+unsigned int BasicOrderedMap<Tree>::size() const {
+    return tree.getNodeCount();
+}
+
+// removes every entry from the map
+template <typename Tree>
+void BasicOrderedMap<Tree>::clear() {
+    tree.clear();
+    if (journal)
+        journal->append(Journal::CLEAR);
+}
+
+// inserts a batch of (key, value) records, building the tree in linear time once they are sorted.
+// much faster than calling insert() once per record when warm-starting a large map.
+// returns the number of keys that were added
+template <typename Tree>
+unsigned int BasicOrderedMap<Tree>::bulkLoad(std::vector<std::pair<Key, Value>> records) {
+    if (journal) {
+        // keys already in the map are dropped, so they aren't logged. a key repeated within records is, but
+        // replay keeps the first of them just as bulkLoad() does
+        for (const auto& record : records) {
+            if (!tree.search(record.first))
+                journal->append(Journal::INSERT, record.first, record.second);
+        }
+    }
+    return tree.bulkLoad(std::move(records));
+}
+
+// writes every entry to a binary snapshot at path, in key order. returns false if the file couldn't be written
+template <typename Tree>
+bool BasicOrderedMap<Tree>::save(const string& path) const {
+    SnapshotWriter writer(path, SNAPSHOT_MAGIC, SNAPSHOT_VERSION);
+    for (Iterator it = begin(); it != end(); ++it) {
+        writeField(writer, it.key());
+        writeField(writer, it.value());
+    }
+    return writer.finish(size(), 0);
+}
+
+// replaces the contents of the map with a snapshot written by save(). the file is mapped into memory and,
+// since its records are already sorted, rebuilt through bulkLoad() in linear time without a single
+// comparison-driven insert. returns false, leaving the map as it was, if path isn't a valid snapshot
+template <typename Tree>
+bool BasicOrderedMap<Tree>::load(const string& path) {
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    SnapshotReader reader(file, SNAPSHOT_MAGIC, SNAPSHOT_VERSION);
+    if (!reader.ok())
+        return false;
+
+    std::vector<std::pair<Key, Value>> records(reader.count());
+    for (auto& record : records) {
+        if (!readField(reader, record.first) || !readField(reader, record.second))
+            return false;
+    }
+    if (journal) {
+        journal->append(Journal::CLEAR);
+        for (const auto& record : records)
+            journal->append(Journal::INSERT, record.first, record.second);
+    }
+    tree.clear();
+    tree.bulkLoad(std::move(records));
+    return true;
+}
+
+// makes the map durable through a write-ahead log (see Journal.h) kept as base.snapshot plus base.log.N
+// segments. if those exist the map is replaced by what they hold, otherwise the journal starts from the
+// current contents. every insert, upsert, remove, clear and load is logged from then on. values changed
+// in place through forEach() are not
+template <typename Tree>
+bool BasicOrderedMap<Tree>::openJournal(const string& base, const JournalOptions& options) {
+    closeJournal();
+    string snapshot = Journal::snapshotPath(base);
+    std::vector<string> segments = Journal::segments(base);
+    if (std::filesystem::exists(snapshot)) {
+        if (!load(snapshot))
+            return false;
+    }
+    else if (!segments.empty()) {
+        tree.clear();
+    }
+    else if (!save(snapshot)) {
+        return false;
+    }
+    for (const string& segment : segments)
+        replay(segment);
+
+    journal.reset(new Journal(base, options, &BasicOrderedMap::compactJournal));
+    return journal->ok();
+}
+
+// syncs and stops the journal. the map's destructor does this too
+template <typename Tree>
+void BasicOrderedMap<Tree>::closeJournal() {
+    journal.reset();
+}
+
+// waits until every change so far is on disk
+template <typename Tree>
+void BasicOrderedMap<Tree>::syncJournal() {
+    if (journal)
+        journal->sync();
+}
+
+// applies the records of a journal segment. runs with no journal open, so nothing is logged again
+template <typename Tree>
+void BasicOrderedMap<Tree>::replay(const string& segment) {
+    Journal::replay(segment, [this](Journal::RecordType type, ByteReader& fields) {
+        Key key;
+        Value value;
+        switch (type) {
+        case Journal::PUT:
+            if (readField(fields, key) && readField(fields, value))
+                tree.upsert(key, std::move(value));
+            break;
+        case Journal::INSERT:
+            if (readField(fields, key) && readField(fields, value))
+                tree.insert(key, std::move(value));
+            break;
+        case Journal::REMOVE:
+            if (readField(fields, key))
+                tree.remove(key);
+            break;
+        case Journal::CLEAR:
+            tree.clear();
+            break;
+        }
+    });
+}
+
+// runs on the journal's compaction thread, so it works on a map of its own
+template <typename Tree>
+bool BasicOrderedMap<Tree>::compactJournal(const string& snapshot, const std::vector<string>& segments) {
+    BasicOrderedMap scratch;
+    if (std::filesystem::exists(snapshot) && !scratch.load(snapshot))
+        return false;
+    for (const string& segment : segments)
+        scratch.replay(segment);
+    return scratch.save(snapshot);
+}
+
+// iterators over the map in ascending key order
+template <typename Tree>
+typename BasicOrderedMap<Tree>::Iterator BasicOrderedMap<Tree>::begin() const {
+    return tree.begin();
+}
+
+template <typename Tree>
+typename BasicOrderedMap<Tree>::Iterator BasicOrderedMap<Tree>::end() const {
+    return tree.end();
+}
+
+// first entry whose key is not less than key
+template <typename Tree>
+typename BasicOrderedMap<Tree>::Iterator BasicOrderedMap<Tree>::lower_bound(const Key& key) const {
+    return tree.lowerBound(key);
+}
+
+// first entry whose key is greater than key
+template <typename Tree>
+typename BasicOrderedMap<Tree>::Iterator BasicOrderedMap<Tree>::upper_bound(const Key& key) const {
+    return tree.upperBound(key);
+}
+
+// every entry with lo <= key <= hi, in ascending order. O(log n) to position plus O(1) amortized per entry
+template <typename Tree>
+typename BasicOrderedMap<Tree>::Range BasicOrderedMap<Tree>::range(const Key& lo, const Key& hi) const {
+    Range result;
+    result.first = lower_bound(lo);
+    result.last = upper_bound(hi);
+    if (tree.keyCompare()(hi, lo)) // an inverted range is empty rather than running to the end of the map
+        result.last = result.first;
+    return result;
+}
+
+// the tree's shape, measured now, and in MAP_STATS builds its rebalancing counts and the latencies
+// of every search, insert and remove since construction or the last resetStats()
+template <typename Tree>
+TreeStats BasicOrderedMap<Tree>::stats() const {
+    TreeStats result;
+    MAP_STAT(result = counters;)
+    tree.stats(result);
+    return result;
+}
+
+template <typename Tree>
+void BasicOrderedMap<Tree>::resetStats() {
+    MAP_STAT(counters = TreeStats();)
+    tree.resetStats();
+}
+
+// what the map holds, by category (see Memory.h). a journal's buffers aren't included
+template <typename Tree>
+MemoryUsage BasicOrderedMap<Tree>::memoryUsage() const {
+    MemoryUsage usage = tree.memoryUsage();
+    usage.other += sizeof(*this) - sizeof(Tree);
+    return usage;
+}
+
+// the original AVL-backed map, and the B+ tree-backed alternative for very large maps
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+using OrderedMap = BasicOrderedMap<AVL<Key, Value, Compare>>;
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+using BPlusOrderedMap = BasicOrderedMap<BPlusTree<Key, Value, Compare>>;
+
+// the string ID -> name interface the project started with, as a thin layer over an int-keyed map.
+// each ID is parsed once on the way in and formatted on the way out, so the tree underneath only
+// ever compares ints. callers that already have integer IDs should use Map directly and skip both
+template <typename Map>
+class StringIDMap {
+private:
+    Map map;
+
+public:
+    using Iterator = typename Map::Iterator;
+    using Range = typename Map::Range;
+
+    bool insert(const string& ID, const string& NAME);
+    bool insert(const string& ID, string&& NAME);
+    bool upsert(const string& ID, const string& NAME);
+    bool upsert(const string& ID, string&& NAME);
+    string search(const string& ID) const;
+    string traverse();
+    void traverse(std::ostream& out);
+    std::vector<string> searchName(const string& NAME);
+    void indexNames(bool enable);
+    template <typename Visitor>
+    void forEach(Visitor visit);
+    bool remove(const string& ID);
+    string select(unsigned int index) const;
+    unsigned int rank(const string& ID) const;
+    bool removeAt(unsigned int index);
+    unsigned int size() const;
+    void clear();
+    unsigned int bulkLoad(const std::vector<std::pair<string, string>>& records);
+    bool save(const string& path) const;
+    bool load(const string& path);
+    bool openJournal(const string& base, const JournalOptions& options = JournalOptions());
+    void closeJournal();
+    void syncJournal();
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lower_bound(const string& ID) const;
+    Iterator upper_bound(const string& ID) const;
+    Range range(const string& LO, const string& HI) const;
+    TreeStats stats() const;
+    void resetStats();
+    MemoryUsage memoryUsage() const;
+};
+
+template <typename Map>
+bool StringIDMap<Map>::insert(const string& ID, const string& NAME) {
+    return map.insert(stoi(ID), NAME);
+}
+
+template <typename Map>
+bool StringIDMap<Map>::insert(const string& ID, string&& NAME) {
+    return map.insert(stoi(ID), std::move(NAME));
+}
+
+// inserts ID, or replaces its name if it already exists. returns true if ID already existed
+template <typename Map>
+bool StringIDMap<Map>::upsert(const string& ID, const string& NAME) {
+    return map.upsert(stoi(ID), NAME);
+}
+
+template <typename Map>
+bool StringIDMap<Map>::upsert(const string& ID, string&& NAME) {
+    return map.upsert(stoi(ID), std::move(NAME));
+}
+
+// returns the name stored under ID, or "" if there is none
+template <typename Map>
+string StringIDMap<Map>::search(const string& ID) const {
+    const string* name = map.search(stoi(ID));
+    if (name == nullptr)
+        return "";
+    return *name;
+}
+
+template <typename Map>
+string StringIDMap<Map>::traverse() {
+    return map.traverse();
+}
+
+template <typename Map>
+void StringIDMap<Map>::traverse(std::ostream& out) {
+    map.traverse(out);
+}
+
+// returns the ID of every entry named NAME in ascending order
+template <typename Map>
+std::vector<string> StringIDMap<Map>::searchName(const string& NAME) {
+    std::vector<string> ids;
+    for (int id : map.searchValue(NAME))
+        ids.push_back(std::to_string(id));
+    return ids;
+}
+
+// keeps a secondary name -> IDs index so searchName() no longer scans the whole map
+template <typename Map>
+void StringIDMap<Map>::indexNames(bool enable) {
+    map.indexValues(enable);
+}
+
+// calls visit(id, name) for every entry in ID order
+template <typename Map>
+template <typename Visitor>
+void StringIDMap<Map>::forEach(Visitor visit) {
+    map.forEach(visit);
+}
+
+template <typename Map>
+bool StringIDMap<Map>::remove(const string& ID) {
+    return map.remove(stoi(ID));
+}
+
+// returns the ID at 0-based position index in sorted order, or "" if index is out of range
+template <typename Map>
+string StringIDMap<Map>::select(unsigned int index) const {
+    int id = 0;
+    if (!map.select(index, id))
+        return "";
+    return std::to_string(id);
+}
+
+// returns the number of IDs in the map that sort before ID
+template <typename Map>
+unsigned int StringIDMap<Map>::rank(const string& ID) const {
+    return map.rank(stoi(ID));
+}
+
+// removes the entry at 0-based position index in sorted order
+template <typename Map>
+bool StringIDMap<Map>::removeAt(unsigned int index) {
+    return map.removeAt(index);
+}
+
+template <typename Map>
+unsigned int StringIDMap<Map>::size() const {
+    return map.size();
+}
+
+template <typename Map>
+void StringIDMap<Map>::clear() {
+    map.clear();
+}
+
+// parses every ID, then hands the batch to Map::bulkLoad()
+template <typename Map>
+unsigned int StringIDMap<Map>::bulkLoad(const std::vector<std::pair<string, string>>& records) {
+    std::vector<std::pair<int, string>> parsed;
+    parsed.reserve(records.size());
+    for (const auto& record : records)
+        parsed.emplace_back(stoi(record.first), record.second);
+    return map.bulkLoad(std::move(parsed));
+}
+
+// snapshots hold the parsed int IDs, so reloading skips stoi() as well as the inserts
+template <typename Map>
+bool StringIDMap<Map>::save(const string& path) const {
+    return map.save(path);
+}
+
+template <typename Map>
+bool StringIDMap<Map>::load(const string& path) {
+    return map.load(path);
+}
+
+template <typename Map>
+bool StringIDMap<Map>::openJournal(const string& base, const JournalOptions& options) {
+    return map.openJournal(base, options);
+}
+
+template <typename Map>
+void StringIDMap<Map>::closeJournal() {
+    map.closeJournal();
+}
+
+template <typename Map>
+void StringIDMap<Map>::syncJournal() {
+    map.syncJournal();
+}
+
+// iterators over the map in ascending ID order. they yield the parsed int IDs
+template <typename Map>
+typename StringIDMap<Map>::Iterator StringIDMap<Map>::begin() const {
+    return map.begin();
+}
+
+template <typename Map>
+typename StringIDMap<Map>::Iterator StringIDMap<Map>::end() const {
+    return map.end();
+}
+
+template <typename Map>
+typename StringIDMap<Map>::Iterator StringIDMap<Map>::lower_bound(const string& ID) const {
+    return map.lower_bound(stoi(ID));
+}
 
+template <typename Map>
+typename StringIDMap<Map>::Iterator StringIDMap<Map>::upper_bound(const string& ID) const {
+    return map.upper_bound(stoi(ID));
 }
 
-bool OrderedMap::insert(const string ID, const string NAME) {
-    return avlTree.insert(NAME, stoi(ID));
+template <typename Map>
+typename StringIDMap<Map>::Range StringIDMap<Map>::range(const string& LO, const string& HI) const {
+    return map.range(stoi(LO), stoi(HI));
 }
 
-string OrderedMap::search(const string ID) {
-    return avlTree.searchID(stoi(ID));
+template <typename Map>
+TreeStats StringIDMap<Map>::stats() const {
+    return map.stats();
 }
 
-string OrderedMap::traverse() {
-    return avlTree.preorderPrint();
+template <typename Map>
+void StringIDMap<Map>::resetStats() {
+    map.resetStats();
 }
 
-bool OrderedMap::remove(const string ID) {
-    return avlTree.remove(stoi(ID));
+template <typename Map>
+MemoryUsage StringIDMap<Map>::memoryUsage() const {
+    return map.memoryUsage();
 }
 
-unsigned int OrderedMap::size() {
-    return avlTree.getNodeCount();
-}
\ No newline at end of file
+// string-ID maps over the AVL and the B+ tree
+using StringIDOrderedMap = StringIDMap<OrderedMap<int, string>>;
+using StringIDBPlusOrderedMap = StringIDMap<BPlusOrderedMap<int, string>>;
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstring>
+#include <ostream>
+#include <string>
+
+// Buffered writer used by the traversal/print functions. Output is collected in a
+// fixed-size buffer and handed to the stream in large chunks, instead of going
+// through operator<< once per node.
+class OutputSink {
+private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+    std::ostream& out;
+    char buffer[BUFFER_SIZE];
+    size_t used = 0;
+
+public:
+    explicit OutputSink(std::ostream& stream);
+    ~OutputSink();
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(const char* data, size_t length);
+    void write(const std::string& text);
+    void write(const char* text);
+    void write(char c);
+    void write(int value);
+    void flush();
+};
+
+inline OutputSink::OutputSink(std::ostream& stream) : out(stream) {
+}
+
+inline OutputSink::~OutputSink() {
+    flush();
+}
+
+inline void OutputSink::write(const char* data, size_t length) {
+    if (used + length > BUFFER_SIZE) {
+        flush();
+        // anything larger than the buffer goes straight to the stream
+        if (length > BUFFER_SIZE) {
+            out.write(data, length);
+            return;
+        }
+    }
+    std::memcpy(buffer + used, data, length);
+    used += length;
+}
+
+inline void OutputSink::write(const std::string& text) {
+    write(text.data(), text.size());
+}
+
+inline void OutputSink::write(const char* text) {
+    write(text, std::strlen(text));
+}
+
+inline void OutputSink::write(char c) {
+    if (used == BUFFER_SIZE)
+        flush();
+    buffer[used++] = c;
+}
+
+// formats an int without going through the stream's locale machinery
+inline void OutputSink::write(int value) {
+    char digits[12];
+    int pos = 12;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[--pos] = char('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+        digits[--pos] = '-';
+    write(digits + pos, 12 - pos);
+}
+
+inline void OutputSink::flush() {
+    if (used > 0) {
+        out.write(buffer, used);
+        used = 0;
+    }
+    out.flush();
+}
@@ -6,4 +6,8 @@ std::mt19937 Random::random(time(0));
 int Random::RandomInt(int min, int max) {
 	std::uniform_int_distribution<int> dist(min, max);
 	return dist(random);
-}
\ No newline at end of file
+}
+
+void Random::Seed(unsigned int seed) {
+	random.seed(seed);
+}
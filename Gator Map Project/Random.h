@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <random>
 
 // Random class used in COP3503 project 3
@@ -8,4 +9,59 @@ private:
 
 public:
 	static int RandomInt(int min, int max);
+	// Restarts the sequence, so a run can be repeated exactly. Until then it is seeded from the clock
+	static void Seed(unsigned int seed);
 };
+
+// Small, fast generator for workloads (xoshiro256**). Unlike Random it has no shared state, so each
+// thread keeps its own and draws numbers without any locking. It is several times faster than
+// mt19937 and its output passes the usual statistical test suites.
+class FastRandom {
+private:
+	uint64_t state[4];
+
+	static uint64_t rotate(uint64_t value, int bits);
+
+public:
+	explicit FastRandom(uint64_t seed);
+	uint64_t next();
+	// Uniform in [0, bound). The modulo bias is below 2^-40 for any bound a map could hold
+	uint64_t below(uint64_t bound);
+	// Uniform in [0, 1)
+	double unit();
+};
+
+inline uint64_t FastRandom::rotate(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// The seed is spread over the whole state with splitmix64, so nearby seeds give unrelated streams
+inline FastRandom::FastRandom(uint64_t seed) {
+	for (uint64_t& word : state) {
+		seed += 0x9e3779b97f4a7c15ull;
+		uint64_t mixed = seed;
+		mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+		mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+		word = mixed ^ (mixed >> 31);
+	}
+}
+
+inline uint64_t FastRandom::next() {
+	uint64_t result = rotate(state[1] * 5, 7) * 9;
+	uint64_t shifted = state[1] << 17;
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= shifted;
+	state[3] = rotate(state[3], 45);
+	return result;
+}
+
+inline uint64_t FastRandom::below(uint64_t bound) {
+	return next() % bound;
+}
+
+inline double FastRandom::unit() {
+	return (double)(next() >> 11) * (1.0 / 9007199254740992.0);
+}
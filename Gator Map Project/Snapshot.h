@@ -0,0 +1,396 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "Hash.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary snapshots of the maps, so a restart can reload millions of entries without inserting them one
+// at a time. A snapshot is a fixed header followed by the map's own records:
+//
+//   magic[4] version count param payloadBytes checksum | payload
+//
+// count is the number of records and param is whatever else the map needs to rebuild itself (the bucket
+// count for UnorderedMap). checksum covers the payload, so a truncated or damaged file is rejected before
+// the map is touched. Numbers are written in the machine's own byte order: snapshots are for restarting
+// the same build, not for moving data between machines.
+
+// The whole file mapped read only into memory. Reloading reads straight out of the page cache instead of
+// copying the file into a buffer first
+class MappedFile {
+private:
+	const char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+	const char* data() const;
+	size_t size() const;
+};
+
+// Payload bytes buffered per write, and hashed per checksum step
+const size_t SNAPSHOT_CHUNK = 1 << 16;
+
+// Layout of the first bytes of every snapshot
+struct SnapshotHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t count;
+	uint64_t param;
+	uint64_t payloadBytes;
+	uint64_t checksum;
+};
+
+// Makes the directory entries for path durable, after it has been created or renamed into place.
+// Windows has no equivalent; its callers ask for write-through instead
+#ifndef _WIN32
+bool syncDirectory(const std::string& path);
+#endif
+
+// Streams a snapshot to disk. The payload goes through a fixed size buffer that is hashed as it is flushed,
+// and the header is filled in last. Everything is written to path + ".tmp", synced, and renamed over path by
+// finish(), so a crash or power loss mid-save leaves the previous snapshot intact
+class SnapshotWriter {
+private:
+	std::FILE* file = nullptr;
+	std::string path;
+	SnapshotHeader header = {};
+	char buffer[SNAPSHOT_CHUNK];
+	size_t used = 0;
+	bool failed = false;
+
+	void flush();
+
+public:
+	SnapshotWriter(const std::string& path, const char magic[4], uint32_t version);
+	~SnapshotWriter();
+	SnapshotWriter(const SnapshotWriter&) = delete;
+	SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+	void write(const void* data, size_t size);
+	// Returns true once the snapshot is complete, in place and on disk
+	bool finish(uint64_t count, uint64_t param);
+};
+
+// Bounds checked reads from a block of memory. Strings are handed out as views into it, so nothing is
+// copied until the map stores them. Once a read fails the reader stays failed
+class ByteReader {
+protected:
+	const char* cursor = nullptr;
+	const char* end = nullptr;
+	bool failed = true;
+
+public:
+	ByteReader() = default;
+	ByteReader(const char* data, size_t size);
+
+	bool ok() const;
+	bool atEnd() const;
+	bool read(void* data, size_t size);
+	bool readView(std::string_view& view, size_t size);
+};
+
+// Reads a snapshot back out of a MappedFile
+class SnapshotReader : public ByteReader {
+private:
+	SnapshotHeader header = {};
+
+public:
+	SnapshotReader(const MappedFile& file, const char magic[4], uint32_t version);
+
+	uint64_t count() const;
+	uint64_t param() const;
+};
+
+// How keys and values are encoded, by snapshots and by the journal alike. Anything trivially copyable
+// is written as raw bytes and strings as a 32 bit length and their characters. Writer is anything with
+// write(const void*, size_t). Other key or value types need their own overloads
+template <typename Writer, typename T>
+typename std::enable_if<std::is_trivially_copyable<T>::value>::type
+writeField(Writer& writer, const T& field) {
+	writer.write(&field, sizeof(T));
+}
+
+template <typename Writer>
+void writeField(Writer& writer, std::string_view field) {
+	uint32_t length = (uint32_t)field.size();
+	writer.write(&length, sizeof(length));
+	writer.write(field.data(), field.size());
+}
+
+template <typename Writer>
+void writeField(Writer& writer, const std::string& field) {
+	writeField(writer, std::string_view(field));
+}
+
+template <typename T>
+typename std::enable_if<std::is_trivially_copyable<T>::value, bool>::type
+readField(ByteReader& reader, T& field) {
+	return reader.read(&field, sizeof(T));
+}
+
+inline bool readField(ByteReader& reader, std::string_view& field) {
+	uint32_t length;
+	return reader.read(&length, sizeof(length)) && reader.readView(field, length);
+}
+
+inline bool readField(ByteReader& reader, std::string& field) {
+	std::string_view view;
+	if (!readField(reader, view))
+		return false;
+	field.assign(view.data(), view.size());
+	return true;
+}
+
+// Folds a block of the payload into the running checksum. Writer and reader both feed it SNAPSHOT_CHUNK sized
+// blocks, so they agree however the payload was produced
+inline uint64_t snapshotChecksum(uint64_t checksum, const char* data, size_t size) {
+	return (checksum ^ hashKey(data, size)) * 0xc6a4a7935bd1e995ull;
+}
+
+inline MappedFile::~MappedFile() {
+	close();
+}
+
+inline bool MappedFile::open(const std::string& path) {
+	close();
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		close();
+		return false;
+	}
+	bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (bytes == nullptr) {
+		close();
+		return false;
+	}
+	length = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps the file alive
+	if (view == MAP_FAILED)
+		return false;
+	// the whole file is about to be read front to back
+	madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+	bytes = (const char*)view;
+	length = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+inline void MappedFile::close() {
+#ifdef _WIN32
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (bytes)
+		munmap((void*)bytes, length);
+#endif
+	bytes = nullptr;
+	length = 0;
+}
+
+inline const char* MappedFile::data() const {
+	return bytes;
+}
+
+inline size_t MappedFile::size() const {
+	return length;
+}
+
+inline SnapshotWriter::SnapshotWriter(const std::string& path, const char magic[4], uint32_t version) : path(path) {
+	std::memcpy(header.magic, magic, 4);
+	header.version = version;
+	file = std::fopen((path + ".tmp").c_str(), "wb");
+	// room for the header, which is only known once the payload has been written
+	failed = file == nullptr || std::fwrite(&header, sizeof(header), 1, file) != 1;
+}
+
+inline SnapshotWriter::~SnapshotWriter() {
+	// only reached with the file still open if finish() was never called
+	if (file) {
+		std::fclose(file);
+		std::remove((path + ".tmp").c_str());
+	}
+}
+
+inline void SnapshotWriter::flush() {
+	if (used == 0)
+		return;
+	header.checksum = snapshotChecksum(header.checksum, buffer, used);
+	header.payloadBytes += used;
+	if (!failed && std::fwrite(buffer, 1, used, file) != used)
+		failed = true;
+	used = 0;
+}
+
+inline void SnapshotWriter::write(const void* data, size_t size) {
+	const char* bytes = (const char*)data;
+	while (size > 0) {
+		size_t step = SNAPSHOT_CHUNK - used < size ? SNAPSHOT_CHUNK - used : size;
+		std::memcpy(buffer + used, bytes, step);
+		used += step;
+		bytes += step;
+		size -= step;
+		if (used == SNAPSHOT_CHUNK)
+			flush();
+	}
+}
+
+#ifndef _WIN32
+inline bool syncDirectory(const std::string& path) {
+	std::string directory = std::filesystem::path(path).parent_path().string();
+	int directoryFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+	if (directoryFd < 0)
+		return false;
+	bool synced = fsync(directoryFd) == 0;
+	::close(directoryFd);
+	return synced;
+}
+#endif
+
+inline bool SnapshotWriter::finish(uint64_t count, uint64_t param) {
+	flush();
+	header.count = count;
+	header.param = param;
+	if (!failed) {
+		failed = std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file) != 1;
+	}
+	// the contents have to reach the disk before the rename does, or a power loss could leave path
+	// naming a file that was never written
+	if (!failed) {
+#ifdef _WIN32
+		failed = std::fflush(file) != 0 || _commit(_fileno(file)) != 0;
+#else
+		failed = std::fflush(file) != 0 || fsync(fileno(file)) != 0;
+#endif
+	}
+	if (file && std::fclose(file) != 0)
+		failed = true;
+	file = nullptr;
+
+	std::string temporary = path + ".tmp";
+	if (failed) {
+		std::remove(temporary.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	// replaces an existing snapshot, and doesn't return until the rename is on disk
+	return MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (std::rename(temporary.c_str(), path.c_str()) != 0)
+		return false;
+	return syncDirectory(path);
+#endif
+}
+
+// Checks the header and the payload's checksum up front, so ok() is false for any file that isn't
+// a complete snapshot of the expected kind
+inline SnapshotReader::SnapshotReader(const MappedFile& file, const char magic[4], uint32_t version) {
+	if (file.size() < sizeof(header))
+		return;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, magic, 4) != 0 || header.version != version)
+		return;
+	// every record takes at least a byte, which keeps a bogus count from sizing a huge allocation
+	if (header.payloadBytes != file.size() - sizeof(header) || header.count > header.payloadBytes)
+		return;
+
+	cursor = file.data() + sizeof(header);
+	end = cursor + header.payloadBytes;
+	uint64_t checksum = 0;
+	for (const char* block = cursor; block < end; block += SNAPSHOT_CHUNK) {
+		size_t size = (size_t)(end - block) < SNAPSHOT_CHUNK ? (size_t)(end - block) : SNAPSHOT_CHUNK;
+		checksum = snapshotChecksum(checksum, block, size);
+	}
+	failed = checksum != header.checksum;
+}
+
+inline uint64_t SnapshotReader::count() const {
+	return header.count;
+}
+
+inline uint64_t SnapshotReader::param() const {
+	return header.param;
+}
+
+inline ByteReader::ByteReader(const char* data, size_t size) : cursor(data), end(data + size), failed(false) {
+}
+
+inline bool ByteReader::ok() const {
+	return !failed;
+}
+
+inline bool ByteReader::atEnd() const {
+	return cursor == end;
+}
+
+inline bool ByteReader::read(void* data, size_t size) {
+	if (failed || (size_t)(end - cursor) < size) {
+		failed = true;
+		return false;
+	}
+	std::memcpy(data, cursor, size);
+	cursor += size;
+	return true;
+}
+
+inline bool ByteReader::readView(std::string_view& view, size_t size) {
+	if (failed || (size_t)(end - cursor) < size) {
+		failed = true;
+		return false;
+	}
+	view = std::string_view(cursor, size);
+	cursor += size;
+	return true;
+}
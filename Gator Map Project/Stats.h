@@ -0,0 +1,207 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Opt-in instrumentation of the maps. Built with MAP_STATS defined (-DMAP_STATS, or in the project's
+// preprocessor definitions) the maps count probes, rehashes and rotations and time every operation.
+// Without it each MAP_STAT(...) disappears during preprocessing, counters included, so a normal
+// build runs exactly the same code as before.
+//
+// Structural metrics (chain lengths, tree height, average depth) are measured on demand by stats(),
+// by walking the map, and are available in either build. They cost nothing until asked for.
+#ifdef MAP_STATS
+#define MAP_STAT(...) __VA_ARGS__
+const bool MAP_STATS_ENABLED = true;
+#else
+#define MAP_STAT(...)
+const bool MAP_STATS_ENABLED = false;
+#endif
+
+// Counts of values in power of two buckets: bucket 0 holds 0 and bucket i holds [2^(i-1), 2^i).
+// Coarse, but fixed size and cheap enough to update on every operation, and wide enough for
+// anything from probe counts to nanoseconds
+class Histogram {
+private:
+	static const int BUCKETS = 65;
+	uint64_t counts[BUCKETS] = {};
+	uint64_t samples = 0;
+	uint64_t total = 0;
+	uint64_t largest = 0;
+
+	static int bucketOf(uint64_t value);
+
+public:
+	void add(uint64_t value);
+	void reset();
+	uint64_t count() const;
+	uint64_t sum() const;
+	uint64_t max() const;
+	double mean() const;
+	// Upper bound of the bucket holding the given fraction of samples, so within a factor of two
+	uint64_t percentile(double fraction) const;
+	// Samples in bucket, for 0 <= bucket < 65
+	uint64_t bucketCount(int bucket) const;
+	// One line: count, mean, p50, p99 and max
+	void print(std::ostream& out) const;
+};
+
+// Records how long the scope it lives in took, in nanoseconds
+class StatTimer {
+private:
+	Histogram* histogram;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit StatTimer(Histogram& histogram);
+	~StatTimer();
+	// For operations whose kind is only known partway through, like operator[] turning out to insert
+	void chargeTo(Histogram& other);
+	StatTimer(const StatTimer&) = delete;
+	StatTimer& operator=(const StatTimer&) = delete;
+};
+
+// What UnorderedMap::stats() and FlatUnorderedMap::stats() report. The histograms and counts other
+// than chainLengths stay empty unless MAP_STATS is defined
+struct HashStats {
+	size_t elements = 0;
+	size_t buckets = 0;	// chained: buckets. Open addressing: slots
+	double loadFactor = 0;
+	Histogram chainLengths;	// chained: entries per bucket. Open addressing: groups probed to reach each entry
+	Histogram probeLengths;	// chained: entries compared per lookup. Open addressing: groups probed per lookup. Only find, contains, at and findBatch count
+	Histogram rehashNs;	// one sample per rehash, so its count is the number of rehashes
+	Histogram lookupNs;
+	Histogram insertNs;
+	Histogram removeNs;
+
+	void print(std::ostream& out) const;
+};
+
+// What OrderedMap::stats() reports, for either backend. The counters and latencies stay empty unless
+// MAP_STATS is defined
+struct TreeStats {
+	enum Rotation { LL, RR, LR, RL };
+
+	size_t entries = 0;
+	int height = 0;	// levels from the root to the deepest entry (AVL) or leaf (B+ tree)
+	double averageDepth = 0;	// nodes visited by a search for a random key that is present
+	uint64_t rotations[4] = {};	// AVL rebalancing, by case
+	uint64_t splits = 0;	// B+ tree rebalancing
+	uint64_t merges = 0;
+	uint64_t borrows = 0;
+	Histogram searchNs;
+	Histogram insertNs;
+	Histogram removeNs;
+
+	void print(std::ostream& out) const;
+};
+
+inline int Histogram::bucketOf(uint64_t value) {
+	int bucket = 0;
+	while (value != 0) {
+		bucket++;
+		value >>= 1;
+	}
+	return bucket;
+}
+
+inline void Histogram::add(uint64_t value) {
+	counts[bucketOf(value)]++;
+	samples++;
+	total += value;
+	if (value > largest)
+		largest = value;
+}
+
+inline void Histogram::reset() {
+	*this = Histogram();
+}
+
+inline uint64_t Histogram::count() const {
+	return samples;
+}
+
+inline uint64_t Histogram::sum() const {
+	return total;
+}
+
+inline uint64_t Histogram::max() const {
+	return largest;
+}
+
+inline double Histogram::mean() const {
+	return samples == 0 ? 0 : (double)total / (double)samples;
+}
+
+inline uint64_t Histogram::percentile(double fraction) const {
+	uint64_t rank = (uint64_t)(fraction * (double)samples + 0.999999);
+	uint64_t seen = 0;
+	for (int bucket = 0; bucket < BUCKETS; bucket++) {
+		seen += counts[bucket];
+		if (seen >= rank && seen > 0) {
+			uint64_t upper = bucket == 0 ? 0 : bucket == 64 ? UINT64_MAX : (1ull << bucket) - 1;
+			return upper < largest ? upper : largest;
+		}
+	}
+	return largest;
+}
+
+inline uint64_t Histogram::bucketCount(int bucket) const {
+	return counts[bucket];
+}
+
+inline void Histogram::print(std::ostream& out) const {
+	out << "count " << samples << ", mean " << mean() << ", p50 <= " << percentile(0.5)
+		<< ", p99 <= " << percentile(0.99) << ", max " << largest;
+}
+
+inline StatTimer::StatTimer(Histogram& histogram) : histogram(&histogram), start(std::chrono::steady_clock::now()) {
+}
+
+inline void StatTimer::chargeTo(Histogram& other) {
+	histogram = &other;
+}
+
+inline StatTimer::~StatTimer() {
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	histogram->add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+inline void HashStats::print(std::ostream& out) const {
+	out << "elements " << elements << ", buckets " << buckets << ", load factor " << loadFactor << "\n";
+	out << "  chain lengths: ";
+	chainLengths.print(out);
+	out << "\n";
+	if (!MAP_STATS_ENABLED) {
+		out << "  (built without MAP_STATS: no counters or latencies)\n";
+		return;
+	}
+	out << "  probe lengths: ";
+	probeLengths.print(out);
+	out << "\n  rehashes: " << rehashNs.count() << ", " << rehashNs.sum() / 1000 << " us in total, longest "
+		<< rehashNs.max() / 1000 << " us\n  lookup ns: ";
+	lookupNs.print(out);
+	out << "\n  insert ns: ";
+	insertNs.print(out);
+	out << "\n  remove ns: ";
+	removeNs.print(out);
+	out << "\n";
+}
+
+inline void TreeStats::print(std::ostream& out) const {
+	out << "entries " << entries << ", height " << height << ", average depth " << averageDepth << "\n";
+	if (!MAP_STATS_ENABLED) {
+		out << "  (built without MAP_STATS: no counters or latencies)\n";
+		return;
+	}
+	out << "  rotations: LL " << rotations[LL] << ", RR " << rotations[RR] << ", LR " << rotations[LR]
+		<< ", RL " << rotations[RL] << "\n  splits " << splits << ", merges " << merges << ", borrows " << borrows
+		<< "\n  search ns: ";
+	searchNs.print(out);
+	out << "\n  insert ns: ";
+	insertNs.print(out);
+	out << "\n  remove ns: ";
+	removeNs.print(out);
+	out << "\n";
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Bump allocator for variable length strings. Strings are copied one after another into large
+// blocks and are never freed one at a time: release() only counts the bytes that became dead,
+// and the owner decides when it is worth copying the live strings into a fresh arena.
+class StringArena {
+private:
+	static const size_t BLOCK_SIZE = 1 << 16;
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t used = BLOCK_SIZE;	// bytes handed out from the newest block
+	size_t liveBytes = 0;
+	size_t deadBytes = 0;
+	size_t heldBytes = 0;	// allocated for blocks, in use or not
+
+public:
+	const char* store(const char* data, size_t length);
+	void release(size_t length);
+	size_t live() const;
+	size_t dead() const;
+	size_t bytes() const;
+	void clear();
+};
+
+inline const char* StringArena::store(const char* data, size_t length) {
+	char* copy;
+	// Big strings get a block of their own, slotted in behind the current one so they don't
+	// strand whatever is left of it
+	if (length > BLOCK_SIZE / 4) {
+		copy = new char[length];
+		heldBytes += length;
+		blocks.emplace(blocks.empty() ? blocks.end() : blocks.end() - 1, copy);
+	}
+	else {
+		if (used + length > BLOCK_SIZE) {
+			blocks.emplace_back(new char[BLOCK_SIZE]);
+			heldBytes += BLOCK_SIZE;
+			used = 0;
+		}
+		copy = blocks.back().get() + used;
+		used += length;
+	}
+	std::memcpy(copy, data, length);
+	liveBytes += length;
+	return copy;
+}
+
+inline void StringArena::release(size_t length) {
+	liveBytes -= length;
+	deadBytes += length;
+}
+
+inline size_t StringArena::live() const {
+	return liveBytes;
+}
+
+inline size_t StringArena::dead() const {
+	return deadBytes;
+}
+
+// Every block and the block list, including the space of released strings and the unused end of the newest block
+inline size_t StringArena::bytes() const {
+	return heldBytes + blocks.capacity() * sizeof(blocks[0]);
+}
+
+inline void StringArena::clear() {
+	blocks.clear();
+	used = BLOCK_SIZE;
+	heldBytes = 0;
+	liveBytes = 0;
+	deadBytes = 0;
+}
@@ -1,389 +1,772 @@
+#pragma once
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include "Hash.h"
+#include "Journal.h"
+#include "Memory.h"
+#include "NodePool.h"
+#include "Prefetch.h"
+#include "Snapshot.h"
+#include "Stats.h"
+#include "StringArena.h"
 using std::string;
 using std::pair;
 
-// My custom linked list class from COP3503 project 1 (modified)
-template <typename T>
-class LinkedList {
-public:
-	struct Node {
-		Node* next = nullptr;
-		Node* prev = nullptr;
-		T key;
-		T value;
+class UnorderedMap {
+private:
+	// One entry of a bucket's chain, 64 bytes on 64 bit builds. Chains are singly linked, entries
+	// come from a slab pool instead of one heap allocation each, and keys of up to INLINE_KEY bytes
+	// (our 8 digit IDs) are stored in the entry itself; longer keys live in the table's arena.
+	// The value stays a std::string because operator[] hands out string&, and its small string
+	// buffer already keeps short names inline.
+	static const uint32_t INLINE_KEY = 16;
+	struct Entry {
+		Entry* next = nullptr;
+		uint32_t hashCode;	// Low half of the key's hash, cached so rehashing and iteration never hash it again
+		uint32_t keyLength;
+		union {
+			char inlineKey[INLINE_KEY];
+			const char* arenaKey;
+		};
+		string value;
+
+		std::string_view key() const;
 	};
 
-	// Accessors
-	Node* Find(const T key);
-	Node* Head();
-	const Node* Head() const;
-	Node* Tail();
-	const Node* Tail() const;
-
-	// Insertion
-	void AddHead(const T key, const T value);
-	void AddTail(const T key, const T value);
+	// Use separate chaining approach with resizable array of chains.
+	// buckets is always a power of two, so a key's bucket is just the low bits of its hash.
+	Entry** map = nullptr;
+	unsigned int buckets;
+	double maxLoad;
+	unsigned int elements;
 
-	// Removal
-	bool Remove(T key);
+	// Growing is spread out over later operations instead of done in one go. While a rehash is in
+	// progress the previous, half-size table is kept in oldMap and every insert or remove moves a few
+	// of its buckets over. Buckets of oldMap below migrateIndex have already been emptied.
+	Entry** oldMap = nullptr;
+	unsigned int oldBuckets = 0;
+	unsigned int migrateIndex = 0;
+	static const unsigned int MIGRATE_STEP = 8;	// old buckets moved per insert/remove
+	static const size_t BATCH_GROUP = 16;	// keys of a batch whose memory accesses are overlapped
+	static constexpr char SNAPSHOT_MAGIC[4] = { 'G', 'M', 'U', 'M' };
+	static const uint32_t SNAPSHOT_VERSION = 1;
+
+	NodePool<Entry> pool;
+	StringArena arena;	// characters of keys longer than INLINE_KEY
+
+	// Set while journaling. operator[] and at() hand out a reference that is only written after they
+	// return, so the entry they returned is remembered in journalPending and logged with its final
+	// value by the next journaled call
+	std::unique_ptr<Journal> journal;
+	Entry* journalPending = nullptr;
+
+	// Probe, rehash and latency counts, only kept in MAP_STATS builds (see Stats.h). Lookups are const,
+	// so the counters are mutable
+	MAP_STAT(mutable HashStats counters;)
+
+	Entry*& bucketFor(uint64_t hashCode) const;
+	template <bool RecordProbes = false>
+	Entry* findEntry(std::string_view key, uint64_t hashCode) const;
+	Entry* createEntry(std::string_view key, uint64_t hashCode);
+	Entry* insertEntry(std::string_view key, uint64_t hashCode);
+	Entry* findOrInsert(std::string_view key, uint64_t hashCode);
+	void prefetchGroup(const std::string_view* keys, size_t count, uint64_t* hashCodes) const;
+	void destroyEntry(Entry* entry);
+	const Entry* firstEntry(bool inOld, unsigned int index) const;
+	template <typename Visit>
+	void forEachEntry(Visit visit);
+	void migrate(unsigned int bucketCount);
+	void compactArena();
+	void removeAll();
+	void journalWrite(Entry* entry);
+	void journalFlushPending();
+	void replay(const std::string& segment);
+	static bool compactJournal(double loadFactor, const std::string& snapshot, const std::vector<std::string>& segments);
 
-	// Operators
-	LinkedList<T>& operator=(const LinkedList<T>& rhs);
+public:
+	class Iterator;
+	UnorderedMap(unsigned int bucketCount, double loadFactor);
+	~UnorderedMap();
+	UnorderedMap(const UnorderedMap&) = delete;
+	UnorderedMap& operator=(const UnorderedMap&) = delete;
+	Iterator begin() const;
+	Iterator end() const;
+	string& operator[] (std::string_view key);
+	// Adds key with a value constructed in place from args, such as a moved-in string. If key is
+	// already present nothing is constructed and false is returned
+	template <typename... Args>
+	bool emplace(std::string_view key, Args&&... args);
+	// Lookups that never insert, allocate or rehash. Any string_view-compatible key works,
+	// so string literals and char buffers don't need to become std::string first.
+	Iterator find(std::string_view key) const;
+	bool contains(std::string_view key) const;
+	string& at(std::string_view key);
+	const string& at(std::string_view key) const;
+	// Many keys at once: values[i] is set to the value of keys[i], or nullptr if it is missing.
+	// Faster than looking the keys up one by one, since the cache misses of several keys overlap
+	void findBatch(const std::string_view* keys, size_t count, const string** values) const;
+	// Same as map[keys[i]] = values[i] for every i, in order
+	void insertBatch(const std::string_view* keys, const string* values, size_t count);
+	void rehash();
+	void remove(std::string_view key);
+	unsigned int size();
+	double loadFactor();
+	// Binary snapshots for fast restarts. load() replaces the whole map and returns false, leaving
+	// the map as it was, if path isn't a snapshot written by save()
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+	// Makes the map durable through a write-ahead log (see Journal.h) kept as base.snapshot plus
+	// base.log.N segments. If those exist the map is replaced by what they hold; otherwise the
+	// journal starts from the current contents. Every change made through operator[], at(),
+	// emplace(), insertBatch(), remove() and load() is logged from then on. A reference returned
+	// by operator[] or at() must not be written to after the next call on the map
+	bool openJournal(const std::string& base, const JournalOptions& options = JournalOptions());
+	// Syncs and stops the journal. The destructor does this too
+	void closeJournal();
+	// Waits until every change so far is on disk
+	void syncJournal();
+	// Chain lengths are measured now, by walking every bucket. The rest is what MAP_STATS builds
+	// have counted since construction or the last resetStats()
+	HashStats stats() const;
+	void resetStats();
+	// What the map holds, by category (see Memory.h). A journal's buffers aren't included
+	MemoryUsage memoryUsage() const;
 
-	// Constructors and Destructor
-	LinkedList();
-	LinkedList(const LinkedList<T>& list);
-	~LinkedList();
+	class Iterator {
+	private:
+		const Entry* nodePtr = nullptr;
+		const UnorderedMap* mapPtr = nullptr;
 
-private:
-	Node* head = nullptr;
-	Node* tail = nullptr;
-	unsigned int nodeCount;
+	public:
+		Iterator(const Entry* p1, const UnorderedMap* p2);
+		Iterator& operator=(Iterator const& rhs);
+		Iterator& operator++();
+		bool operator!=(Iterator const& rhs);
+		bool operator==(Iterator const& rhs);
+		// The key and value are viewed in place, so dereferencing never copies or allocates
+		pair<std::string_view, const string&> operator*() const;
+		friend class UnorderedMap;
+	};
 };
 
-template <typename T>
-void LinkedList<T>::AddHead(const T key, const T value) {
-	Node* newNode = new Node;
-	newNode->key = key;
-	newNode->value = value;
+inline std::string_view UnorderedMap::Entry::key() const {
+	if (keyLength <= INLINE_KEY) {
+		return std::string_view(inlineKey, keyLength);
+	}
+	return std::string_view(arenaKey, keyLength);
+}
 
-	// If there are no nodes in the list...
-	if (!head) {
-		head = newNode;
-		tail = newNode;
+inline UnorderedMap::UnorderedMap(unsigned int bucketCount, double loadFactor) {
+	// Round up to a power of two so bucket indexes can be masked out of the hash
+	buckets = 1;
+	while (buckets < bucketCount) {
+		buckets *= 2;
 	}
-	// If there is at least one node in the list...
-	else {
-		newNode->next = head;
-		head->prev = newNode;
-		head = newNode;
+	maxLoad = loadFactor;
+	elements = 0;
+	map = new Entry*[buckets]();
+}
+
+inline UnorderedMap::~UnorderedMap() {
+	closeJournal();
+	// The pool would free the memory anyway, but the values' destructors still have to run
+	forEachEntry([this](Entry* entry) { pool.destroy(entry); });
+	delete[] map;
+	delete[] oldMap;
+}
+
+// The chain that holds (or would hold) a key. Mid-rehash, a key whose old bucket hasn't been
+// migrated yet is still in oldMap, so each lookup only ever searches one chain.
+inline UnorderedMap::Entry*& UnorderedMap::bucketFor(uint64_t hashCode) const {
+	if (oldMap) {
+		unsigned int oldIndex = (unsigned int)(hashCode & (oldBuckets - 1));
+		if (oldIndex >= migrateIndex) {
+			return oldMap[oldIndex];
+		}
 	}
-	nodeCount++;    // Number of nodes increases by one after adding a new head.
+	return map[hashCode & (buckets - 1)];
 }
 
-template <typename T>
-void LinkedList<T>::AddTail(const T key, const T value) {
-	Node* newNode = new Node;
-	newNode->key = key;
-	newNode->value = value;
-	if (!head) {
-		head = newNode;
-		tail = newNode;
+// Compares the cached hash codes first so a mismatched key is almost always rejected
+// without touching its characters. The lookup entry points set RecordProbes, so probeLengths
+// isn't mixed up with the searches inserts make first.
+template <bool RecordProbes>
+UnorderedMap::Entry* UnorderedMap::findEntry(std::string_view key, uint64_t hashCode) const {
+	MAP_STAT(uint64_t probes = 0;)
+	for (Entry* entry = bucketFor(hashCode); entry; entry = entry->next) {
+		MAP_STAT(probes++;)
+		if (entry->hashCode == (uint32_t)hashCode && entry->key() == key) {
+			MAP_STAT(if (RecordProbes) counters.probeLengths.add(probes);)
+			return entry;
+		}
+	}
+	MAP_STAT(if (RecordProbes) counters.probeLengths.add(probes);)
+	return nullptr;
+}
+
+inline UnorderedMap::Entry* UnorderedMap::createEntry(std::string_view key, uint64_t hashCode) {
+	Entry* entry = pool.create();
+	entry->hashCode = (uint32_t)hashCode;
+	entry->keyLength = (uint32_t)key.size();
+	if (key.size() <= INLINE_KEY) {
+		std::memcpy(entry->inlineKey, key.data(), key.size());
 	}
 	else {
-		newNode->prev = tail;
-		tail->next = newNode;
-		tail = newNode;
+		entry->arenaKey = arena.store(key.data(), key.size());
 	}
-	nodeCount++;
+	return entry;
 }
 
-template <typename T>
-LinkedList<T>::LinkedList() {
-	nodeCount = 0;
-	head = nullptr;
-	tail = nullptr;
+inline void UnorderedMap::destroyEntry(Entry* entry) {
+	if (entry->keyLength > INLINE_KEY) {
+		arena.release(entry->keyLength);
+	}
+	pool.destroy(entry);
 }
 
-template <typename T>
-LinkedList<T>::~LinkedList() {
-	Node* currentNode = head;
-	Node* temp = currentNode;
-
-	// Traverse the list and delete each node one by one.
-	while (currentNode) {
-		temp = currentNode->next;
-		delete currentNode;
-		currentNode = temp;
+// Head of the first non empty bucket at or after index. The new table is walked first, then
+// whatever is left of the old one.
+inline const UnorderedMap::Entry* UnorderedMap::firstEntry(bool inOld, unsigned int index) const {
+	if (!inOld) {
+		for (; index < buckets; index++) {
+			if (map[index]) {
+				return map[index];
+			}
+		}
+		index = migrateIndex;
+	}
+	if (oldMap) {
+		for (; index < oldBuckets; index++) {
+			if (oldMap[index]) {
+				return oldMap[index];
+			}
+		}
 	}
-	/* Error with copy assignment operator, fixed by reassigning head
-	 * and tail pointers to null after the list was deleted.
-	 */
-	head = nullptr;
-	tail = nullptr;
+	return nullptr;
 }
 
-template <typename T>
-typename LinkedList<T>::Node* LinkedList<T>::Head() {
-	return head;
+// Calls visit on every entry in both tables. visit may destroy the entry it is given.
+template <typename Visit>
+void UnorderedMap::forEachEntry(Visit visit) {
+	for (unsigned int i = 0; i < buckets; i++) {
+		for (Entry* entry = map[i]; entry; ) {
+			Entry* next = entry->next;
+			visit(entry);
+			entry = next;
+		}
+	}
+	for (unsigned int i = migrateIndex; i < oldBuckets; i++) {
+		for (Entry* entry = oldMap[i]; entry; ) {
+			Entry* next = entry->next;
+			visit(entry);
+			entry = next;
+		}
+	}
 }
 
-template <typename T>
-const typename LinkedList<T>::Node* LinkedList<T>::Head() const {
-	return head;
+// Moves up to bucketCount buckets of the old table into the new one. Entries are relinked rather than
+// copied, so pointers to them (and references to their values) stay valid.
+inline void UnorderedMap::migrate(unsigned int bucketCount) {
+	while (oldMap && bucketCount > 0) {
+		Entry* entry = oldMap[migrateIndex];
+		while (entry) {
+			Entry* next = entry->next;
+			Entry*& head = map[entry->hashCode & (buckets - 1)];
+			entry->next = head;
+			head = entry;
+			entry = next;
+		}
+		oldMap[migrateIndex] = nullptr;
+		migrateIndex++;
+		bucketCount--;
+		if (migrateIndex == oldBuckets) {
+			delete[] oldMap;
+			oldMap = nullptr;
+			oldBuckets = 0;
+			migrateIndex = 0;
+		}
+	}
 }
 
-template <typename T>
-typename LinkedList<T>::Node* LinkedList<T>::Tail() {
-	return tail;
+// Copies the long keys that are still in use into a fresh arena, dropping the space of removed ones.
+// remove() only calls this once the dead bytes outweigh the live ones, so the copying is amortized
+// over at least as many bytes of removed keys.
+inline void UnorderedMap::compactArena() {
+	StringArena compacted;
+	forEachEntry([&compacted](Entry* entry) {
+		if (entry->keyLength > INLINE_KEY) {
+			entry->arenaKey = compacted.store(entry->arenaKey, entry->keyLength);
+		}
+	});
+	arena = std::move(compacted);
 }
 
-template <typename T>
-const typename LinkedList<T>::Node* LinkedList<T>::Tail() const {
-	return tail;
+inline UnorderedMap::Iterator UnorderedMap::begin() const {
+	// If all chains are empty, this is the same as end
+	return Iterator(firstEntry(false, 0), this);
 }
 
-template <typename T>
-typename LinkedList<T>::Node* LinkedList<T>::Find(const T key) {
-	Node* currentNode = head;
-	while (currentNode) {
-		if (currentNode->key == key) {
-			return currentNode;
-		}
-		currentNode = currentNode->next;
-	}
-	return nullptr;
+inline UnorderedMap::Iterator UnorderedMap::end() const {
+	return Iterator(nullptr, this);
 }
 
-template <typename T>
-LinkedList<T>::LinkedList(const LinkedList<T>& list) {
-	// Delete old list.
-	Node* currentNode = head;
-	Node* temp = currentNode;
-	while (currentNode) {
-		temp = currentNode->next;
-		delete currentNode;
-		currentNode = temp;
-	}
-	head = nullptr;
-	tail = nullptr;
-	Node* copy = list.head;
-	while (copy) {
-		// Allocate space for new list and copy data.
-		AddTail(copy->key, copy->value);
-		copy = copy->next;
-	}
-}
-
-template <typename T>
-LinkedList<T>& LinkedList<T>::operator=(const LinkedList<T>& rhs) {
-	Node* currentNode = head;
-	Node* temp = currentNode;
-	while (currentNode) {
-		temp = currentNode->next;
-		delete currentNode;
-		currentNode = temp;
-	}
-	head = nullptr;
-	tail = nullptr;
-	Node* copy = rhs.head;
-	while (copy) {
-		AddTail(copy->key, copy->value);
-		copy = copy->next;
+// Timed as a lookup when the key is found and as an insert when it has to be added
+inline string& UnorderedMap::operator[] (std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	// The key is hashed exactly once. Every later step reuses hashCode.
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	Entry* entry = findEntry(key, hashCode);
+	if (!entry) {
+		MAP_STAT(timer.chargeTo(counters.insertNs);)
+		entry = insertEntry(key, hashCode);
 	}
-	return *this;
+	if (journal) {
+		journalWrite(entry);
+	}
+	return entry->value;
 }
 
-template <typename T>
-bool LinkedList<T>::Remove(T key) {
-	Node* currentNode = head;
+inline UnorderedMap::Entry* UnorderedMap::findOrInsert(std::string_view key, uint64_t hashCode) {
+	Entry* entry = findEntry(key, hashCode);
 
-	// Edge case
-	if (nodeCount == 1) {
-		delete head;
-		head = nullptr;
-		tail = nullptr;
-		nodeCount--;
-		return true;
+	// If key doesn't exist, construct the value and place in map.
+	if (!entry) {
+		entry = insertEntry(key, hashCode);
 	}
 
-	while (currentNode && currentNode->next && currentNode->prev) {
-		// If data at current node matches passed in data...
-		if (currentNode->key == key) {
-			// Store the current node into a temporary new node.
-			Node* remove = currentNode;
-
-			// Set the next and previous pointers accordingly.
-			currentNode->prev->next = currentNode->next;
-			currentNode->next->prev = currentNode->prev;
+	return entry;
+}
 
-			// Iterate to next element in the list.
-			currentNode = currentNode->next;
+template <typename... Args>
+bool UnorderedMap::emplace(std::string_view key, Args&&... args) {
+	MAP_STAT(StatTimer timer(counters.insertNs);)
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	if (findEntry(key, hashCode)) {
+		return false;
+	}
+	Entry* entry = insertEntry(key, hashCode);
+	entry->value = string(std::forward<Args>(args)...);
+	if (journal) {
+		journalFlushPending();
+		journal->append(Journal::PUT, key, entry->value);
+	}
+	return true;
+}
 
-			// Delete the current node.
-			delete remove;
+// Links a new entry for a key that isn't in the map yet, then takes the insert's share of
+// migration and growth. Migration and rehash only relink entries, so the entry stays valid through both
+inline UnorderedMap::Entry* UnorderedMap::insertEntry(std::string_view key, uint64_t hashCode) {
+	Entry* entry = createEntry(key, hashCode);
+	Entry*& head = bucketFor(hashCode);
+	entry->next = head;
+	head = entry;
+	elements++;
+	migrate(MIGRATE_STEP);
+	rehash();
+	return entry;
+}
 
-			// Decrement node count.
-			nodeCount--;
-			return true;
-		}
-		else {
-			currentNode = currentNode->next;
+// Hashes a group of keys and starts loading the bucket slot, then the first entry, of each.
+// By the time the keys are resolved one by one their lines are in cache or on their way
+inline void UnorderedMap::prefetchGroup(const std::string_view* keys, size_t count, uint64_t* hashCodes) const {
+	Entry** heads[BATCH_GROUP];
+	for (size_t i = 0; i < count; i++) {
+		hashCodes[i] = hashKey(keys[i].data(), keys[i].size());
+		heads[i] = &bucketFor(hashCodes[i]);
+		prefetch(heads[i]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (*heads[i]) {
+			prefetch(*heads[i]);
 		}
 	}
-	return false;
 }
 
-unsigned int hashFunction(char const* key, int table_size) {
-	unsigned int hashCode = 0;
-	unsigned int temp;
-	for (int i = 0; key[i] != '\0'; i++) {
-		unsigned int ascii = int(key[i]);
-		if (i % 2 == 0) {
-			temp = (hashCode << 7) ^ ascii ^ (hashCode >> 3);
+inline void UnorderedMap::findBatch(const std::string_view* keys, size_t count, const string** values) const {
+	uint64_t hashCodes[BATCH_GROUP];
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		prefetchGroup(keys + first, group, hashCodes);
+		for (size_t i = 0; i < group; i++) {
+			Entry* entry = findEntry<true>(keys[first + i], hashCodes[i]);
+			values[first + i] = entry ? &entry->value : nullptr;
 		}
-		else {
-			temp = (hashCode << 11) ^ ascii ^ (hashCode >> 5);
-			temp = ~temp;
-		}
-		hashCode = hashCode ^ temp;
 	}
-	hashCode = hashCode & 0x7FFFFFFF;
-	return (hashCode % table_size);
 }
 
-class UnorderedMap {
-private:
-	// Use separate chaining approach with resizable array of linked lists
-	LinkedList<string>* map = nullptr;
-	unsigned int buckets;
-	double maxLoad;
-	unsigned int elements;
+// Prefetching is only a hint, so an insert that migrates or grows the table partway through a
+// group costs the rest of the group some misses but never correctness
+inline void UnorderedMap::insertBatch(const std::string_view* keys, const string* values, size_t count) {
+	uint64_t hashCodes[BATCH_GROUP];
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		prefetchGroup(keys + first, group, hashCodes);
+		for (size_t i = 0; i < group; i++) {
+			findOrInsert(keys[first + i], hashCodes[i])->value = values[first + i];
+			if (journal) {
+				journalFlushPending();
+				journal->append(Journal::PUT, keys[first + i], values[first + i]);
+			}
+		}
+	}
+}
 
-public:
-	class Iterator;
-	UnorderedMap(unsigned int bucketCount, double loadFactor);
-	~UnorderedMap();
-	Iterator begin() const;
-	Iterator end() const;
-	string& operator[] (string const& key);
-	void rehash();
-	void remove(string const& key);
-	unsigned int size();
-	double loadFactor();
+inline UnorderedMap::Iterator UnorderedMap::find(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	return Iterator(findEntry<true>(key, hashKey(key.data(), key.size())), this);
+}
 
-	class Iterator {
-	private:
-		const LinkedList<string>::Node* nodePtr = nullptr;
-		const UnorderedMap* mapPtr = nullptr;
+inline bool UnorderedMap::contains(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	return findEntry<true>(key, hashKey(key.data(), key.size())) != nullptr;
+}
 
-	public:
-		Iterator(const LinkedList<string>::Node* p1, const UnorderedMap* p2);
-		Iterator& operator=(Iterator const& rhs);
-		Iterator& operator++();
-		bool operator!=(Iterator const& rhs);
-		bool operator==(Iterator const& rhs);
-		pair<string, string> operator*() const;
-		friend class UnorderedMap;
-	};
-};
+// Throws std::out_of_range if the key is missing, like std::unordered_map::at
+inline string& UnorderedMap::at(std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	Entry* entry = findEntry<true>(key, hashKey(key.data(), key.size()));
+	if (!entry) {
+		throw std::out_of_range("UnorderedMap::at: key not found");
+	}
+	if (journal) {
+		journalWrite(entry);
+	}
+	return entry->value;
+}
 
-UnorderedMap::UnorderedMap(unsigned int bucketCount, double loadFactor) {
-	buckets = bucketCount;
-	maxLoad = loadFactor;
-	elements = 0;
-	map = new LinkedList<string>[buckets];
+// A plain lookup: unlike the non-const at(), nothing is handed out for writing, so nothing is journaled
+inline const string& UnorderedMap::at(std::string_view key) const {
+	MAP_STAT(StatTimer timer(counters.lookupNs);)
+	const Entry* entry = findEntry<true>(key, hashKey(key.data(), key.size()));
+	if (!entry) {
+		throw std::out_of_range("UnorderedMap::at: key not found");
+	}
+	return entry->value;
 }
 
-UnorderedMap::~UnorderedMap() {
-	delete[] map;
+// Starts growing into a table twice the size. Only the empty table is allocated here; the entries
+// follow a few buckets at a time through migrate(). Doubling gives every old bucket at least
+// buckets * maxLoad / 2 inserts' worth of MIGRATE_STEP moves, so a migration normally finishes long
+// before the next one is due. If one is still running, it is completed first. The time counted
+// as the rehash is that allocation plus any finishing migration; the later migration steps are
+// counted in the inserts and removes that perform them
+inline void UnorderedMap::rehash() {
+	if (loadFactor() >= maxLoad) {
+		MAP_STAT(StatTimer timer(counters.rehashNs);)
+		if (oldMap) {
+			migrate(oldBuckets);
+		}
+		oldMap = map;
+		oldBuckets = buckets;
+		migrateIndex = 0;
+		buckets *= 2;
+		map = new Entry*[buckets]();
+	}
 }
 
-UnorderedMap::Iterator UnorderedMap::begin() const {
-	for (unsigned int i = 0; i < buckets; i++) {
-		// Check for first non empty linked list in array
-		if (map[i].Head()) {
-			return Iterator(map[i].Head(), this);
+inline void UnorderedMap::remove(std::string_view key) {
+	MAP_STAT(StatTimer timer(counters.removeNs);)
+	uint64_t hashCode = hashKey(key.data(), key.size());
+	// Walk the chain through the links themselves so the match can be unlinked without a prev pointer
+	for (Entry** link = &bucketFor(hashCode); *link; link = &(*link)->next) {
+		Entry* entry = *link;
+		if (entry->hashCode == (uint32_t)hashCode && entry->key() == key) {
+			if (journal) {
+				journalFlushPending();
+				journal->append(Journal::REMOVE, key);
+			}
+			*link = entry->next;
+			destroyEntry(entry);
+			elements--;
+			break;
 		}
 	}
-	// If all linked lists in array are empty, return same as end
-	return end();
+	migrate(MIGRATE_STEP);
+	if (arena.dead() > arena.live() && arena.dead() >= (1 << 16)) {
+		compactArena();
+	}
 }
 
-UnorderedMap::Iterator UnorderedMap::end() const {
-	return Iterator(nullptr, this);
+inline unsigned int UnorderedMap::size() {
+	return elements;
 }
 
-string& UnorderedMap::operator[] (string const& key) {
-	const char* convertedKey = key.c_str();
-	unsigned int index = hashFunction(convertedKey, buckets);
+inline double UnorderedMap::loadFactor() {
+	return ((double)elements / buckets);
+}
 
-	// If key doesn't exist, construct the value and place in map
-	if (!map[index].Find(key)) {
-		map[index].AddHead(key, "");
-		elements++;
-		rehash();
-		// Update index after rehash since bucket count changes
-		index = hashFunction(convertedKey, buckets);
+// Mid-rehash each bucket of the new table and each not yet migrated bucket of the old one is a
+// chain of its own, so every chain a lookup could walk is counted once
+inline HashStats UnorderedMap::stats() const {
+	HashStats result;
+	MAP_STAT(result = counters;)
+	result.elements = elements;
+	result.buckets = buckets;
+	result.loadFactor = (double)elements / buckets;
+	auto chainLength = [](const Entry* entry) {
+		uint64_t length = 0;
+		for (; entry; entry = entry->next) {
+			length++;
+		}
+		return length;
+	};
+	for (unsigned int i = 0; i < buckets; i++) {
+		result.chainLengths.add(chainLength(map[i]));
 	}
+	for (unsigned int i = migrateIndex; i < oldBuckets; i++) {
+		result.chainLengths.add(chainLength(oldMap[i]));
+	}
+	return result;
+}
 
-	return map[index].Find(key)->value;
+inline void UnorderedMap::resetStats() {
+	MAP_STAT(counters = HashStats();)
 }
 
-void UnorderedMap::rehash() {
-	if (loadFactor() >= maxLoad) {
-		buckets *= 2;
-		LinkedList<string>* temp = new LinkedList<string>[buckets];
-		for (unsigned int i = 0; i < buckets / 2; i++) {
-			LinkedList<string>::Node* curr = map[i].Head();
-			while (curr) {
-				const char* convertedkey = curr->key.c_str();
-				unsigned int index = hashFunction(convertedkey, buckets);
-				temp[index].AddHead(curr->key, curr->value);
-				curr = curr->next;
+// Short keys are inside the entries and long ones in the arena, whose dead bytes still count until
+// it is compacted. Mid-rehash both tables are held
+inline MemoryUsage UnorderedMap::memoryUsage() const {
+	MemoryUsage usage;
+	usage.table = ((size_t)buckets + oldBuckets) * sizeof(Entry*);
+	usage.nodes = pool.liveBytes();
+	usage.freeNodes = pool.bytes() - usage.nodes;
+	usage.keys = arena.bytes();
+	for (Iterator it = begin(); it != end(); ++it) {
+		usage.values += heapBytes(it.nodePtr->value);
+	}
+	usage.other = sizeof(*this);
+	return usage;
+}
+
+// Each entry is written with its cached hash code, so load() can put it straight into its chain
+inline bool UnorderedMap::save(const std::string& path) const {
+	SnapshotWriter writer(path, SNAPSHOT_MAGIC, SNAPSHOT_VERSION);
+	for (Iterator it = begin(); it != end(); ++it) {
+		const Entry* entry = it.nodePtr;
+		writeField(writer, entry->hashCode);
+		writeField(writer, entry->key());
+		writeField(writer, entry->value);
+	}
+	return writer.finish(elements, buckets);
+}
+
+// The snapshot is mapped into memory and rebuilt in one linear pass. The table is allocated at its saved
+// size and every entry is linked in by its saved hash code, so nothing is hashed, rehashed or compared
+inline bool UnorderedMap::load(const std::string& path) {
+	MappedFile file;
+	if (!file.open(path)) {
+		return false;
+	}
+	SnapshotReader reader(file, SNAPSHOT_MAGIC, SNAPSHOT_VERSION);
+	uint64_t bucketCount = reader.param();
+	if (!reader.ok() || reader.count() > UINT32_MAX || bucketCount == 0 || bucketCount > (1u << 31) || (bucketCount & (bucketCount - 1)) != 0) {
+		return false;
+	}
+
+	Entry** table = new Entry*[bucketCount]();
+	uint64_t loaded = 0;
+	for (; loaded < reader.count(); loaded++) {
+		uint32_t hashCode;
+		std::string_view key, value;
+		if (!readField(reader, hashCode) || !readField(reader, key) || !readField(reader, value)) {
+			break;
+		}
+		Entry* entry = createEntry(key, hashCode);
+		entry->value.assign(value.data(), value.size());
+		Entry*& head = table[hashCode & (bucketCount - 1)];
+		entry->next = head;
+		head = entry;
+	}
+
+	// A damaged record throws away what was loaded so far and keeps the current contents
+	if (loaded != reader.count()) {
+		for (uint64_t i = 0; i < bucketCount; i++) {
+			for (Entry* entry = table[i]; entry; ) {
+				Entry* next = entry->next;
+				destroyEntry(entry);
+				entry = next;
 			}
 		}
-		delete[] map;
-		map = temp;
+		delete[] table;
+		return false;
+	}
+
+	forEachEntry([this](Entry* entry) { destroyEntry(entry); });
+	delete[] map;
+	delete[] oldMap;
+	oldMap = nullptr;
+	oldBuckets = 0;
+	migrateIndex = 0;
+	map = table;
+	buckets = (unsigned int)bucketCount;
+	elements = (unsigned int)loaded;
+	// the keys of whatever the map held before are dead now
+	if (arena.dead() > arena.live() && arena.dead() >= (1 << 16)) {
+		compactArena();
 	}
+
+	if (journal) {
+		journalPending = nullptr;
+		journal->append(Journal::CLEAR);
+		forEachEntry([this](Entry* entry) { journal->append(Journal::PUT, entry->key(), entry->value); });
+	}
+	return true;
 }
 
-void UnorderedMap::remove(string const& key) {
-	const char* convertedKey = key.c_str();
-	unsigned int index = hashFunction(convertedKey, buckets);
-	if (map[index].Remove(key)) {
-		elements--;
+inline bool UnorderedMap::openJournal(const std::string& base, const JournalOptions& options) {
+	closeJournal();
+	std::string snapshot = Journal::snapshotPath(base);
+	std::vector<std::string> segments = Journal::segments(base);
+	if (std::filesystem::exists(snapshot)) {
+		if (!load(snapshot)) {
+			return false;
+		}
+	}
+	else if (!segments.empty()) {
+		removeAll();
 	}
+	else if (!save(snapshot)) {
+		return false;
+	}
+	for (const std::string& segment : segments) {
+		replay(segment);
+	}
+
+	double loadFactor = maxLoad;
+	journal.reset(new Journal(base, options, [loadFactor](const std::string& snapshot, const std::vector<std::string>& segments) {
+		return compactJournal(loadFactor, snapshot, segments);
+	}));
+	return journal->ok();
 }
 
-unsigned int UnorderedMap::size() {
-	return elements;
+inline void UnorderedMap::closeJournal() {
+	if (journal) {
+		journalFlushPending();
+		journal.reset();
+	}
 }
 
-double UnorderedMap::loadFactor() {
-	return ((double)elements / buckets);
+inline void UnorderedMap::syncJournal() {
+	if (journal) {
+		journalFlushPending();
+		journal->sync();
+	}
 }
 
-UnorderedMap::Iterator::Iterator(const LinkedList<string>::Node* p1, const UnorderedMap* p2) {
+// Called with the entry operator[] or at() is about to hand out. The previous one has been
+// written to by now, so it is logged, and this one waits for the next call
+inline void UnorderedMap::journalWrite(Entry* entry) {
+	if (journalPending != entry) {
+		journalFlushPending();
+		journalPending = entry;
+	}
+}
+
+inline void UnorderedMap::journalFlushPending() {
+	if (journalPending) {
+		journal->append(Journal::PUT, journalPending->key(), journalPending->value);
+		journalPending = nullptr;
+	}
+}
+
+inline void UnorderedMap::removeAll() {
+	forEachEntry([this](Entry* entry) { destroyEntry(entry); });
+	delete[] oldMap;
+	oldMap = nullptr;
+	oldBuckets = 0;
+	migrateIndex = 0;
+	std::fill(map, map + buckets, nullptr);
+	elements = 0;
+	arena.clear();
+}
+
+// Applies the records of a journal segment. Runs with no journal open, so nothing is logged again
+inline void UnorderedMap::replay(const std::string& segment) {
+	Journal::replay(segment, [this](Journal::RecordType type, ByteReader& fields) {
+		std::string_view key, value;
+		switch (type) {
+		case Journal::PUT:
+			if (readField(fields, key) && readField(fields, value)) {
+				(*this)[key].assign(value.data(), value.size());
+			}
+			break;
+		case Journal::INSERT:
+			if (readField(fields, key) && readField(fields, value)) {
+				emplace(key, value);
+			}
+			break;
+		case Journal::REMOVE:
+			if (readField(fields, key)) {
+				remove(key);
+			}
+			break;
+		case Journal::CLEAR:
+			removeAll();
+			break;
+		}
+	});
+}
+
+// Runs on the journal's compaction thread, so it works on a map of its own
+inline bool UnorderedMap::compactJournal(double loadFactor, const std::string& snapshot, const std::vector<std::string>& segments) {
+	UnorderedMap scratch(16, loadFactor);
+	if (std::filesystem::exists(snapshot) && !scratch.load(snapshot)) {
+		return false;
+	}
+	for (const std::string& segment : segments) {
+		scratch.replay(segment);
+	}
+	return scratch.save(snapshot);
+}
+
+inline UnorderedMap::Iterator::Iterator(const Entry* p1, const UnorderedMap* p2) {
 	nodePtr = p1;
 	mapPtr = p2;
 }
 
-UnorderedMap::Iterator& UnorderedMap::Iterator::operator=(Iterator const& rhs) {
+inline UnorderedMap::Iterator& UnorderedMap::Iterator::operator=(Iterator const& rhs) {
 	nodePtr = rhs.nodePtr;
 	return *this;
 }
 
-UnorderedMap::Iterator& UnorderedMap::Iterator::operator++() {
-	const char* convertedkey = nodePtr->key.c_str();
-	unsigned int nextIndex = hashFunction(convertedkey, mapPtr->buckets) + 1;
-	for (unsigned int i = nextIndex; i < mapPtr->buckets; i++) {
-		if (nodePtr && nodePtr->next) {
-			nodePtr = nodePtr->next;
-			return *this;
-		}
-		else if (nodePtr && !nodePtr->next) {
-			if (mapPtr->map[i].Head()) {
-				nodePtr = mapPtr->map[i].Head();
-				return *this;
-			}
+inline UnorderedMap::Iterator& UnorderedMap::Iterator::operator++() {
+	// Finish the current bucket's chain first. This also covers the last bucket,
+	// which the search below never visits.
+	if (nodePtr->next) {
+		nodePtr = nodePtr->next;
+		return *this;
+	}
+	// The cached hash gives the current table and bucket without rehashing the key
+	bool inOld = false;
+	unsigned int index = nodePtr->hashCode & (mapPtr->buckets - 1);
+	if (mapPtr->oldMap) {
+		unsigned int oldIndex = nodePtr->hashCode & (mapPtr->oldBuckets - 1);
+		if (oldIndex >= mapPtr->migrateIndex) {
+			inOld = true;
+			index = oldIndex;
 		}
 	}
-	nodePtr = nullptr;
+	nodePtr = mapPtr->firstEntry(inOld, index + 1);
 	return *this;
 }
 
-bool UnorderedMap::Iterator::operator!=(Iterator const& rhs) {
+inline bool UnorderedMap::Iterator::operator!=(Iterator const& rhs) {
 	return (nodePtr != rhs.nodePtr);
 }
 
-bool UnorderedMap::Iterator::operator==(Iterator const& rhs) {
+inline bool UnorderedMap::Iterator::operator==(Iterator const& rhs) {
 	return (nodePtr == rhs.nodePtr);
 }
 
-pair<string, string> UnorderedMap::Iterator::operator*() const {
-	return make_pair(nodePtr->key, nodePtr->value);
-}
\ No newline at end of file
+inline pair<std::string_view, const string&> UnorderedMap::Iterator::operator*() const {
+	return pair<std::string_view, const string&>(nodePtr->key(), nodePtr->value);
+}
@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "Hash.h"
+#include "Random.h"
+
+// YCSB style workloads. A workload starts from a number of loaded records and issues a mix of reads,
+// updates, inserts, removes and short scans whose records are chosen by a skewed distribution, like
+// real traffic where a few IDs get most of the requests. Records are numbered in insertion order and
+// keyOf() turns each into a distinct 8 digit ID, so the maps see keys spread over the whole ID range.
+//
+// Each thread draws its operations from its own Workload::Generator, which has its own FastRandom and
+// shares nothing with the others except the count of inserted records.
+struct WorkloadSpec {
+	enum Distribution {
+		UNIFORM,
+		ZIPFIAN,	// a few records are very popular, wherever they are in the key space
+		LATEST,		// zipfian over age: the newest records are the most popular
+		HOTSPOT		// hotOperations of the operations go to a hot set of hotRecords of the records
+	};
+
+	const char* name = "custom";
+	// The operation mix, as fractions adding up to 1
+	double read = 1;
+	double update = 0;
+	double insert = 0;
+	double remove = 0;
+	double scan = 0;
+	Distribution distribution = ZIPFIAN;
+	double zipfTheta = 0.99;	// YCSB's skew. Closer to 1 is more skewed
+	double hotRecords = 0.2;
+	double hotOperations = 0.8;
+	unsigned int maxScanLength = 100;	// scans cover 1 to maxScanLength records, uniformly
+
+	// The core YCSB workloads
+	static WorkloadSpec ycsbA();	// update heavy: 50% read, 50% update
+	static WorkloadSpec ycsbB();	// read mostly: 95% read, 5% update
+	static WorkloadSpec ycsbC();	// read only
+	static WorkloadSpec ycsbD();	// read latest: 95% read, 5% insert
+	static WorkloadSpec ycsbE();	// short ranges: 95% scan, 5% insert
+	// Not in YCSB: IDs coming and going, 60% read, 20% update, 10% insert, 10% remove
+	static WorkloadSpec churn();
+};
+
+struct WorkloadOperation {
+	enum Type : uint8_t { READ, UPDATE, INSERT, REMOVE, SCAN };
+	Type type;
+	unsigned int scanLength;	// records covered, for scans
+	uint64_t record;
+};
+
+// Zipfian ranks from Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as used by
+// YCSB. Rank 0 is the most popular. zeta(n) is summed once up front, then extended incrementally
+// when the item count grows, so a growing workload never pays for it twice
+class ZipfianGenerator {
+private:
+	uint64_t items;
+	double theta;
+	double alpha;
+	double zeta2;
+	double zetaN;
+	double eta;
+
+	void grow(uint64_t count);
+
+public:
+	ZipfianGenerator(uint64_t items, double theta);
+	uint64_t next(FastRandom& random);
+	// A rank in [0, count). count may only grow from one call to the next
+	uint64_t next(FastRandom& random, uint64_t count);
+};
+
+class Workload {
+private:
+	WorkloadSpec spec;
+	uint64_t loaded;
+	std::atomic<uint64_t> records;	// loaded plus every insert handed out so far
+	ZipfianGenerator zipfian;	// summed once, then copied by every generator
+
+public:
+	class Generator {
+	private:
+		Workload& workload;
+		FastRandom random;
+		ZipfianGenerator zipfian;
+
+		uint64_t chooseRecord();
+
+	public:
+		Generator(Workload& workload, uint64_t seed);
+		WorkloadOperation next();
+	};
+
+	Workload(const WorkloadSpec& spec, uint64_t loadedRecords);
+	Workload(const Workload&) = delete;
+	Workload& operator=(const Workload&) = delete;
+
+	const WorkloadSpec& settings() const;
+	uint64_t loadedRecords() const;
+	uint64_t recordCount() const;
+	Generator generator(uint64_t seed);
+	// The ID of a record. Records are mapped through a fixed permutation of [0, 10^8) (an affine map
+	// with a multiplier coprime to 10^8), so consecutive records get far apart, never equal, IDs
+	static int keyOf(uint64_t record);
+};
+
+inline WorkloadSpec WorkloadSpec::ycsbA() {
+	WorkloadSpec spec;
+	spec.name = "YCSB A";
+	spec.read = 0.5;
+	spec.update = 0.5;
+	return spec;
+}
+
+inline WorkloadSpec WorkloadSpec::ycsbB() {
+	WorkloadSpec spec;
+	spec.name = "YCSB B";
+	spec.read = 0.95;
+	spec.update = 0.05;
+	return spec;
+}
+
+inline WorkloadSpec WorkloadSpec::ycsbC() {
+	WorkloadSpec spec;
+	spec.name = "YCSB C";
+	return spec;
+}
+
+inline WorkloadSpec WorkloadSpec::ycsbD() {
+	WorkloadSpec spec;
+	spec.name = "YCSB D";
+	spec.read = 0.95;
+	spec.insert = 0.05;
+	spec.distribution = LATEST;
+	return spec;
+}
+
+inline WorkloadSpec WorkloadSpec::ycsbE() {
+	WorkloadSpec spec;
+	spec.name = "YCSB E";
+	spec.read = 0;
+	spec.scan = 0.95;
+	spec.insert = 0.05;
+	return spec;
+}
+
+inline WorkloadSpec WorkloadSpec::churn() {
+	WorkloadSpec spec;
+	spec.name = "churn";
+	spec.read = 0.6;
+	spec.update = 0.2;
+	spec.insert = 0.1;
+	spec.remove = 0.1;
+	return spec;
+}
+
+inline ZipfianGenerator::ZipfianGenerator(uint64_t items, double theta) : items(0), theta(theta) {
+	alpha = 1.0 / (1.0 - theta);
+	zeta2 = 1.0 + std::pow(0.5, theta);
+	zetaN = 0;
+	grow(std::max<uint64_t>(items, 1));
+}
+
+inline void ZipfianGenerator::grow(uint64_t count) {
+	for (uint64_t i = items; i < count; i++) {
+		zetaN += 1.0 / std::pow((double)(i + 1), theta);
+	}
+	items = count;
+	eta = (1.0 - std::pow(2.0 / (double)items, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+}
+
+inline uint64_t ZipfianGenerator::next(FastRandom& random) {
+	double u = random.unit();
+	double uz = u * zetaN;
+	if (uz < 1.0)
+		return 0;
+	if (uz < zeta2)
+		return 1;
+	uint64_t rank = (uint64_t)((double)items * std::pow(eta * u - eta + 1.0, alpha));
+	return std::min(rank, items - 1);
+}
+
+inline uint64_t ZipfianGenerator::next(FastRandom& random, uint64_t count) {
+	if (count > items)
+		grow(count);
+	return next(random);
+}
+
+inline Workload::Workload(const WorkloadSpec& spec, uint64_t loadedRecords)
+	: spec(spec), loaded(loadedRecords), records(loadedRecords), zipfian(loadedRecords, spec.zipfTheta) {
+}
+
+inline const WorkloadSpec& Workload::settings() const {
+	return spec;
+}
+
+inline uint64_t Workload::loadedRecords() const {
+	return loaded;
+}
+
+inline uint64_t Workload::recordCount() const {
+	return records.load(std::memory_order_relaxed);
+}
+
+inline Workload::Generator Workload::generator(uint64_t seed) {
+	return Generator(*this, seed);
+}
+
+inline int Workload::keyOf(uint64_t record) {
+	return (int)((record % 100000000 * 48271 + 12345678) % 100000000);
+}
+
+inline Workload::Generator::Generator(Workload& workload, uint64_t seed)
+	: workload(workload), random(seed), zipfian(workload.zipfian) {
+}
+
+inline uint64_t Workload::Generator::chooseRecord() {
+	uint64_t count = std::max<uint64_t>(workload.recordCount(), 1);
+	const WorkloadSpec& spec = workload.spec;
+	switch (spec.distribution) {
+	case WorkloadSpec::ZIPFIAN: {
+		// YCSB's scrambled zipfian: ranks are hashed so the popular records are scattered over the
+		// key space instead of all being the first ones loaded
+		uint64_t rank = zipfian.next(random);
+		return hashKey((const char*)&rank, sizeof(rank)) % count;
+	}
+	case WorkloadSpec::LATEST:
+		return count - 1 - zipfian.next(random, count);
+	case WorkloadSpec::HOTSPOT: {
+		uint64_t hot = std::min(count, std::max<uint64_t>(1, (uint64_t)(spec.hotRecords * (double)count)));
+		if (hot == count || random.unit() < spec.hotOperations)
+			return random.below(hot);
+		return hot + random.below(count - hot);
+	}
+	default:
+		return random.below(count);
+	}
+}
+
+inline WorkloadOperation Workload::Generator::next() {
+	const WorkloadSpec& spec = workload.spec;
+	WorkloadOperation operation;
+	operation.scanLength = 0;
+	double pick = random.unit();
+	if ((pick -= spec.insert) < 0) {
+		operation.type = WorkloadOperation::INSERT;
+		operation.record = workload.records.fetch_add(1, std::memory_order_relaxed);
+		return operation;
+	}
+	if ((pick -= spec.update) < 0)
+		operation.type = WorkloadOperation::UPDATE;
+	else if ((pick -= spec.remove) < 0)
+		operation.type = WorkloadOperation::REMOVE;
+	else if ((pick -= spec.scan) < 0)
+		operation.type = WorkloadOperation::SCAN;
+	else
+		operation.type = WorkloadOperation::READ;
+	if (operation.type == WorkloadOperation::SCAN)
+		operation.scanLength = 1 + (unsigned int)random.below(std::max(spec.maxScanLength, 1u));
+	operation.record = chooseRecord();
+	return operation;
+}
@@ -0,0 +1,593 @@
+#include "OrderedMap.h"
+#include "UnorderedMap.h"
+#include "FlatUnorderedMap.h"
+#include "ConcurrentOrderedMap.h"
+#include "ConcurrentUnorderedMap.h"
+#include "Journal.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::to_string;
+
+// Correctness checks for the maps, kept apart from the benchmarks in test.cpp. Every backend is run
+// through a long random sequence of operations next to a std::map holding what it should contain, and
+// each result is compared on the spot. The concurrent maps are also run with readers beside writers,
+// checking what the readers see. The journal is checked across a clean restart, a process that dies
+// without closing it and a segment whose last record was torn.
+//
+// usage: checks [--seed N] [--dir DIRECTORY]
+//
+// Journals are written under DIRECTORY, by default gator-map-checks in the system's temporary
+// directory. The exit status is 0 only if every check passed.
+
+const int CHILD_RECORDS = 200;	// written by the --crash-child process
+
+int failures = 0;
+
+// Counts and reports a failed check. Unlike assert() it is still there in release builds. Only the
+// first few are printed, since one bug tends to fail the same check over and over
+void expect(bool passed, const string& what) {
+	if (!passed && ++failures <= 20) {
+		std::cerr << "FAILED: " << what << endl;
+	}
+}
+
+// every entry of an ordered map, in its own iteration order
+template <typename Map>
+std::vector<std::pair<int, string>> orderedContents(const Map& map) {
+	std::vector<std::pair<int, string>> contents;
+	for (auto it = map.begin(); it != map.end(); ++it) {
+		contents.emplace_back(it.key(), it.value());
+	}
+	return contents;
+}
+
+template <typename Map>
+std::map<string, string> unorderedContents(Map& map) {
+	std::map<string, string> contents;
+	for (auto it = map.begin(); it != map.end(); ++it) {
+		auto entry = *it;
+		contents.emplace(string(entry.first), entry.second);
+	}
+	return contents;
+}
+
+// Random inserts, upserts, emplaces, removes and positional queries, checked against std::map after
+// every operation, with the whole map and a random range compared every few thousand operations
+template <typename Map>
+void orderedAgainstStdMap(const char* backend, unsigned int seed) {
+	Map map;
+	std::map<int, string> expected;
+	std::mt19937 random(seed);
+	const int keys = 5000;
+	for (int i = 0; i < 100000; i++) {
+		int key = (int)(random() % keys);
+		string value = "v" + to_string(i);
+		switch (random() % 8) {
+		case 0:
+			expect(map.insert(key, value) == expected.emplace(key, value).second, string(backend) + " insert");
+			break;
+		case 1: {
+			bool existed = expected.count(key) != 0;
+			expected[key] = value;
+			expect(map.upsert(key, string(value)) == existed, string(backend) + " upsert");
+			break;
+		}
+		case 2:
+			expect(map.emplace(key, 3, 'e') == expected.emplace(key, string(3, 'e')).second, string(backend) + " emplace");
+			break;
+		case 3:
+			expect(map.remove(key) == (expected.erase(key) == 1), string(backend) + " remove");
+			break;
+		case 4:
+			if (!expected.empty()) {
+				unsigned int index = (unsigned int)(random() % expected.size());
+				expect(map.removeAt(index), string(backend) + " removeAt");
+				expected.erase(std::next(expected.begin(), index));
+			}
+			break;
+		case 5: {
+			auto found = expected.find(key);
+			const string* value = map.search(key);
+			expect(found == expected.end() ? value == nullptr : value != nullptr && *value == found->second, string(backend) + " search");
+			break;
+		}
+		case 6: {
+			unsigned int index = (unsigned int)(random() % (expected.size() + 2));
+			int selected = -1;
+			bool found = map.select(index, selected);
+			expect(found == (index < expected.size()), string(backend) + " select");
+			if (found && index < expected.size())
+				expect(selected == std::next(expected.begin(), index)->first, string(backend) + " select key");
+			break;
+		}
+		default:
+			expect(map.rank(key) == (unsigned int)std::distance(expected.begin(), expected.lower_bound(key)), string(backend) + " rank");
+			break;
+		}
+		expect(map.size() == expected.size(), string(backend) + " size");
+
+		if (i % 5000 == 4999) {
+			expect(orderedContents(map) == std::vector<std::pair<int, string>>(expected.begin(), expected.end()), string(backend) + " contents");
+			int lo = (int)(random() % keys);
+			int hi = lo + (int)(random() % 500);
+			std::vector<std::pair<int, string>> scanned;
+			for (auto entry : map.range(lo, hi)) {
+				scanned.emplace_back(entry.first, entry.second);
+			}
+			expect(scanned == std::vector<std::pair<int, string>>(expected.lower_bound(lo), expected.upper_bound(hi)), string(backend) + " range");
+		}
+	}
+}
+
+// Random writes, lookups and removes checked against std::map. Half the keys are longer than the
+// chained map stores inline, so they go through its arena
+template <typename Map>
+void unorderedAgainstStdMap(const char* backend, unsigned int seed) {
+	Map map(8, 0.8);
+	std::map<string, string> expected;
+	std::mt19937 random(seed);
+	for (int i = 0; i < 100000; i++) {
+		string key = to_string(random() % 5000);
+		if (random() % 2)
+			key += string(20, 'k');
+		string value = "v" + to_string(i);
+		switch (random() % 6) {
+		case 0:
+			map[key] = value;
+			expected[key] = value;
+			break;
+		case 1:
+			expect(map.emplace(key, value) == expected.emplace(key, value).second, string(backend) + " emplace");
+			break;
+		case 2:
+			map.remove(key);
+			expected.erase(key);
+			break;
+		case 3: {
+			auto found = expected.find(key);
+			bool threw = false;
+			try {
+				const Map& constMap = map;
+				const string& value = constMap.at(key);
+				expect(found != expected.end() && value == found->second, string(backend) + " at");
+			}
+			catch (const std::out_of_range&) {
+				threw = true;
+			}
+			expect(threw == (found == expected.end()), string(backend) + " at miss");
+			break;
+		}
+		case 4:
+			expect(map.contains(key) == (expected.count(key) != 0), string(backend) + " contains");
+			break;
+		default: {
+			auto found = map.find(key);
+			expect((found != map.end()) == (expected.count(key) != 0), string(backend) + " find");
+			if (found != map.end())
+				expect((*found).second == expected[key], string(backend) + " find value");
+			break;
+		}
+		}
+		expect(map.size() == expected.size(), string(backend) + " size");
+		if (i % 5000 == 4999)
+			expect(unorderedContents(map) == expected, string(backend) + " contents");
+	}
+}
+
+// Single threaded against std::map, then 4 lock-free readers beside 3 writers. Even keys are only
+// ever upserted, so readers must always find them, and every value starts with its own key
+void concurrentUnorderedChecks(unsigned int seed) {
+	{
+		ConcurrentUnorderedMap map(1, 0.8);
+		std::map<string, string> expected;
+		std::mt19937 random(seed);
+		for (int i = 0; i < 100000; i++) {
+			string key = to_string(random() % 5000);
+			string value = "v" + to_string(i);
+			string found;
+			switch (random() % 4) {
+			case 0: {
+				bool existed = expected.count(key) != 0;
+				expected[key] = value;
+				expect(map.upsert(key, value) == existed, "concurrent chained upsert");
+				break;
+			}
+			case 1:
+				expect(map.insert(key, value) == expected.emplace(key, value).second, "concurrent chained insert");
+				break;
+			case 2:
+				expect(map.remove(key) == (expected.erase(key) == 1), "concurrent chained remove");
+				break;
+			default:
+				expect(map.find(key, found) == (expected.count(key) != 0), "concurrent chained find");
+				expect(expected.count(key) == 0 || found == expected[key], "concurrent chained find value");
+				break;
+			}
+			expect(map.size() == expected.size(), "concurrent chained size");
+		}
+		std::map<string, string> contents;
+		map.forEach([&](const string& key, const string& value) { contents[key] = value; });
+		expect(contents == expected, "concurrent chained contents");
+	}
+
+	const int keys = 20000;
+	ConcurrentUnorderedMap map(1, 0.8);
+	for (int key = 0; key < keys; key += 2) {
+		map.upsert(to_string(key), to_string(key) + "/0");
+	}
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++) {
+		readers.emplace_back([&, t] {
+			std::mt19937 random(seed + t);
+			string value;
+			while (!stop) {
+				int key = (int)(random() % keys);
+				string text = to_string(key);
+				if (map.find(text, value) && value.compare(0, text.size() + 1, text + "/") != 0)
+					bad++;
+				if (key % 2 == 0 && !map.contains(text))
+					bad++;
+			}
+		});
+	}
+	std::vector<std::thread> writers;
+	for (int t = 0; t < 3; t++) {
+		writers.emplace_back([&, t] {
+			std::mt19937 random(seed + 100 + t);
+			for (int i = 0; i < 10 * keys; i++) {
+				int key = (int)(random() % keys);
+				string text = to_string(key);
+				if (key % 2 == 0)
+					map.upsert(text, text + "/" + to_string(i));
+				else if (random() % 2)
+					map.upsert(text, text + "/x");
+				else
+					map.remove(text);
+			}
+		});
+	}
+	for (std::thread& writer : writers) {
+		writer.join();
+	}
+	stop = true;
+	for (std::thread& reader : readers) {
+		reader.join();
+	}
+	expect(bad == 0, "concurrent chained readers saw a missing or wrong value");
+	size_t visited = 0;
+	map.forEach([&](const string&, const string&) { visited++; });
+	expect(visited == map.size(), "concurrent chained forEach after writers");
+}
+
+// Single threaded against std::map, then 4 readers searching and scanning snapshots beside a
+// churning writer. Every name is "n" + its ID, and a snapshot must stay sorted and the size it says
+void concurrentOrderedChecks(unsigned int seed) {
+	{
+		ConcurrentOrderedMap map;
+		std::map<int, string> expected;
+		std::mt19937 random(seed);
+		for (int i = 0; i < 50000; i++) {
+			int key = (int)(random() % 5000);
+			string id = to_string(key);
+			string name = "n" + to_string(i);
+			switch (random() % 5) {
+			case 0: {
+				bool existed = expected.count(key) != 0;
+				expected[key] = name;
+				expect(map.upsert(id, name) == existed, "concurrent AVL upsert");
+				break;
+			}
+			case 1:
+				expect(map.insert(id, name) == expected.emplace(key, name).second, "concurrent AVL insert");
+				break;
+			case 2:
+				expect(map.remove(id) == (expected.erase(key) == 1), "concurrent AVL remove");
+				break;
+			case 3: {
+				auto found = expected.find(key);
+				expect(map.search(id) == (found == expected.end() ? "" : found->second), "concurrent AVL search");
+				expect(map.rank(id) == (unsigned int)std::distance(expected.begin(), expected.lower_bound(key)), "concurrent AVL rank");
+				break;
+			}
+			default: {
+				unsigned int index = (unsigned int)(random() % (expected.size() + 2));
+				string selected = map.select(index);
+				expect(selected == (index < expected.size() ? to_string(std::next(expected.begin(), index)->first) : ""), "concurrent AVL select");
+				break;
+			}
+			}
+			expect(map.size() == expected.size(), "concurrent AVL size");
+
+			if (i % 2500 == 2499) {
+				// a snapshot keeps showing the version it pinned while the map changes under it
+				ConcurrentOrderedMap::Snapshot snapshot = map.snapshot();
+				map.upsert("1", "changed");
+				map.remove("2");
+				std::vector<std::pair<int, string>> pinned;
+				for (auto it = snapshot.begin(); it != snapshot.end(); ++it) {
+					pinned.emplace_back(it.id(), it.name());
+				}
+				expect(pinned == std::vector<std::pair<int, string>>(expected.begin(), expected.end()), "concurrent AVL snapshot");
+				int lo = (int)(random() % 5000);
+				int hi = lo + (int)(random() % 500);
+				std::vector<std::pair<int, string>> scanned;
+				for (auto entry : snapshot.range(to_string(lo), to_string(hi))) {
+					scanned.emplace_back(entry.first, entry.second);
+				}
+				expect(scanned == std::vector<std::pair<int, string>>(expected.lower_bound(lo), expected.upper_bound(hi)), "concurrent AVL snapshot range");
+				expected[1] = "changed";
+				expected.erase(2);
+			}
+		}
+	}
+
+	const int keys = 20000;
+	ConcurrentOrderedMap map;
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++) {
+		readers.emplace_back([&, t] {
+			std::mt19937 random(seed + t);
+			for (long n = 0; !stop; n++) {
+				int key = (int)(random() % keys);
+				string name = map.search(to_string(key));
+				if (!name.empty() && name != "n" + to_string(key))
+					bad++;
+				if (n % 50 != 0)
+					continue;
+				ConcurrentOrderedMap::Snapshot snapshot = map.snapshot();
+				int previous = -1;
+				unsigned int count = 0;
+				for (auto it = snapshot.begin(); it != snapshot.end(); ++it) {
+					if (it.id() <= previous || it.name() != "n" + to_string(it.id()))
+						bad++;
+					previous = it.id();
+					count++;
+				}
+				if (count != snapshot.size())
+					bad++;
+			}
+		});
+	}
+	std::mt19937 random(seed + 100);
+	for (int i = 0; i < 10 * keys; i++) {
+		int key = (int)(random() % keys);
+		if (random() % 3)
+			map.upsert(to_string(key), "n" + to_string(key));
+		else
+			map.remove(to_string(key));
+	}
+	stop = true;
+	for (std::thread& reader : readers) {
+		reader.join();
+	}
+	expect(bad == 0, "concurrent AVL readers saw a wrong name or an inconsistent snapshot");
+}
+
+// Random mutations through a journal with tiny segments, so compaction runs many times, then a
+// clean restart that must rebuild exactly the same map
+template <typename Map>
+void orderedJournalChecks(const char* backend, const string& base, unsigned int seed) {
+	std::map<int, string> expected;
+	std::mt19937 random(seed);
+	{
+		Map map;
+		map.insert(-1, string("before the journal"));
+		expected[-1] = "before the journal";
+		JournalOptions options;
+		options.compactBytes = 4096;
+		options.flushInterval = std::chrono::milliseconds(1);
+		expect(map.openJournal(base, options), string(backend) + " openJournal");
+		for (int i = 0; i < 20000; i++) {
+			int key = (int)(random() % 3000);
+			string value = "v" + to_string(i);
+			switch (random() % 5) {
+			case 0:
+				if (map.insert(key, value))
+					expected.emplace(key, value);
+				break;
+			case 1:
+				map.upsert(key, string(value));
+				expected[key] = value;
+				break;
+			case 2:
+				map.remove(key);
+				expected.erase(key);
+				break;
+			case 3:
+				if (map.emplace(key, 3, 'z'))
+					expected.emplace(key, "zzz");
+				break;
+			default:
+				if (!expected.empty()) {
+					unsigned int index = (unsigned int)(random() % expected.size());
+					map.removeAt(index);
+					expected.erase(std::next(expected.begin(), index));
+				}
+				break;
+			}
+		}
+	}
+	{
+		Map map;
+		expect(map.openJournal(base), string(backend) + " reopen");
+		expect(orderedContents(map) == std::vector<std::pair<int, string>>(expected.begin(), expected.end()), string(backend) + " replayed contents");
+		map.clear();
+		map.insert(7, string("seven"));
+	}
+	Map map;
+	expect(map.openJournal(base), string(backend) + " reopen after clear");
+	expect(map.size() == 1 && map.search(7) && *map.search(7) == "seven", string(backend) + " replayed clear");
+}
+
+void unorderedJournalChecks(const string& base, unsigned int seed) {
+	std::map<string, string> expected;
+	std::mt19937 random(seed);
+	{
+		UnorderedMap map(8, 0.8);
+		JournalOptions options;
+		options.compactBytes = 8192;
+		options.flushInterval = std::chrono::milliseconds(1);
+		expect(map.openJournal(base, options), "chained openJournal");
+		for (int i = 0; i < 30000; i++) {
+			string key = to_string(random() % 4000) + (i % 2 ? string(20, 'L') : "");
+			string value = "x" + to_string(i);
+			switch (random() % 6) {
+			case 0:
+				map[key] = value;
+				expected[key] = value;
+				break;
+			case 1:
+				// written through the reference after operator[] returns
+				map[key] += "!";
+				expected[key] += "!";
+				break;
+			case 2:
+				if (expected.count(key)) {
+					map.at(key) = value;
+					expected[key] = value;
+				}
+				break;
+			case 3:
+				map.remove(key);
+				expected.erase(key);
+				break;
+			case 4:
+				if (map.emplace(key, value))
+					expected.emplace(key, value);
+				break;
+			default: {
+				string second = "batch" + key;
+				std::string_view batchKeys[2] = { key, second };
+				string batchValues[2] = { value, value };
+				map.insertBatch(batchKeys, batchValues, 2);
+				expected[key] = value;
+				expected[second] = value;
+				break;
+			}
+			}
+		}
+	}
+	UnorderedMap map(8, 0.8);
+	expect(map.openJournal(base), "chained reopen");
+	expect(unorderedContents(map) == expected, "chained replayed contents");
+}
+
+// What the --crash-child process runs: every write waits for its record to be on disk, then the
+// process ends without closing anything, as if it had been killed
+void crashChild(const string& directory) {
+	JournalOptions options;
+	options.syncEachWrite = true;
+	OrderedMap<int, string> ordered;
+	UnorderedMap unordered(8, 0.8);
+	if (!ordered.openJournal(directory + "/crash-ordered", options) || !unordered.openJournal(directory + "/crash-unordered", options))
+		std::_Exit(1);
+	for (int i = 0; i < CHILD_RECORDS; i++) {
+		ordered.insert(i, string("durable"));
+		unordered.emplace(to_string(i), "durable");
+	}
+	std::_Exit(0);
+}
+
+// Every record a dead process synced has to come back. Then a half written record is appended to
+// each segment, as a crash partway through a write would leave it, and replay has to stop cleanly
+// in front of it and keep working afterwards
+void crashChecks(const char* program, const string& directory) {
+	std::fflush(stdout);
+	string command = "\"" + string(program) + "\" --crash-child \"" + directory + "\"";
+#ifdef _WIN32
+	command = "\"" + command + "\""; // cmd.exe strips the outermost quotes of a command with more than two
+#endif
+	if (std::system(command.c_str()) != 0) {
+		expect(false, "crash child couldn't write its journals");
+		return;
+	}
+	{
+		OrderedMap<int, string> ordered;
+		UnorderedMap unordered(8, 0.8);
+		expect(ordered.openJournal(directory + "/crash-ordered") && ordered.size() == CHILD_RECORDS, "synced ordered records survive a crash");
+		expect(unordered.openJournal(directory + "/crash-unordered") && unordered.size() == CHILD_RECORDS, "synced chained records survive a crash");
+	}
+
+	const char tornRecord[] = { 0x10, 0x00, 0x00 };
+	for (const char* name : { "/crash-ordered", "/crash-unordered" }) {
+		for (const std::string& segment : Journal::segments(directory + name)) {
+			std::ofstream(segment, std::ios::app | std::ios::binary).write(tornRecord, sizeof(tornRecord));
+		}
+	}
+	{
+		OrderedMap<int, string> ordered;
+		expect(ordered.openJournal(directory + "/crash-ordered") && ordered.size() == CHILD_RECORDS, "ordered replay stops at a torn record");
+		ordered.insert(CHILD_RECORDS, string("after the tear"));
+		UnorderedMap unordered(8, 0.8);
+		expect(unordered.openJournal(directory + "/crash-unordered") && unordered.size() == CHILD_RECORDS, "chained replay stops at a torn record");
+		unordered.emplace("after", "the tear");
+	}
+	OrderedMap<int, string> ordered;
+	expect(ordered.openJournal(directory + "/crash-ordered") && ordered.size() == CHILD_RECORDS + 1, "ordered writes after a torn record replay");
+	UnorderedMap unordered(8, 0.8);
+	expect(unordered.openJournal(directory + "/crash-unordered") && unordered.size() == CHILD_RECORDS + 1, "chained writes after a torn record replay");
+}
+
+// Runs one group of checks and reports whether it added any failures
+template <typename Checks>
+void run(const char* name, Checks checks) {
+	int before = failures;
+	cout << name << "... " << std::flush;
+	checks();
+	cout << (failures == before ? "ok" : "FAILED") << endl;
+}
+
+int main(int argc, char** argv) {
+	unsigned int seed = 3503;
+	string directory = (std::filesystem::temp_directory_path() / "gator-map-checks").string();
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--seed") == 0) {
+			seed = (unsigned int)std::strtoul(argv[i + 1], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--dir") == 0) {
+			directory = argv[i + 1];
+		}
+		else if (std::strcmp(argv[i], "--crash-child") == 0) {
+			crashChild(argv[i + 1]);
+		}
+		else {
+			std::cerr << "unknown option " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	run("AVL against std::map", [&] { orderedAgainstStdMap<OrderedMap<int, string>>("AVL", seed); });
+	run("B+ tree against std::map", [&] { orderedAgainstStdMap<BPlusOrderedMap<int, string>>("B+ tree", seed); });
+	run("chained against std::map", [&] { unorderedAgainstStdMap<UnorderedMap>("chained", seed); });
+	run("open addressing against std::map", [&] { unorderedAgainstStdMap<FlatUnorderedMap>("open addressing", seed); });
+	run("concurrent chained", [&] { concurrentUnorderedChecks(seed); });
+	run("concurrent AVL", [&] { concurrentOrderedChecks(seed); });
+
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+	run("AVL journal", [&] { orderedJournalChecks<OrderedMap<int, string>>("AVL journal", directory + "/avl", seed); });
+	run("B+ tree journal", [&] { orderedJournalChecks<BPlusOrderedMap<int, string>>("B+ tree journal", directory + "/bplus", seed); });
+	run("chained journal", [&] { unorderedJournalChecks(directory + "/chained", seed); });
+	run("journal crash and torn tail", [&] { crashChecks(argv[0], directory); });
+	std::filesystem::remove_all(directory);
+
+	cout << (failures == 0 ? "all checks passed" : to_string(failures) + " checks failed") << endl;
+	return failures == 0 ? 0 : 1;
+}
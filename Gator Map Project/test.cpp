@@ -1,189 +1,825 @@
 #include "OrderedMap.h"
 #include "UnorderedMap.h"
+#include "FlatUnorderedMap.h"
+#include "ConcurrentOrderedMap.h"
+#include "ConcurrentUnorderedMap.h"
+#include "Benchmark.h"
+#include "Memory.h"
 #include "Random.h"
+#include "Workload.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <ctime>
-#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 using std::cout;
 using std::endl;
 using std::to_string;
-using namespace std::chrono;
-
-void orderedInsert(int n);
-void unorderedInsert(int n);
-void orderedSearch(int n);
-void unorderedSearch(int n);
-void orderedTraverse(int n);
-void unorderedTraverse(int n);
-void unorderedRemove(int n);
-
-int main() {
-	// Testing ordered map insertions
-	orderedInsert(1000);
-	orderedInsert(10000);
-	orderedInsert(100000);
-
-	// Testing unordered map insertions
-	unorderedInsert(1000);
-	unorderedInsert(10000);
-	unorderedInsert(100000);
-
-	// Testing ordered map searches
-	orderedSearch(1000);
-	orderedSearch(10000);
-	orderedSearch(100000);
-
-	// Testing unordered map searches
-	unorderedSearch(1000);
-	unorderedSearch(10000);
-	unorderedSearch(100000);
-
-	// Testing ordered map traversal
-	orderedTraverse(1000);
-	orderedTraverse(10000);
-	orderedTraverse(100000);
-
-	// Testing unordered map traversal
-	unorderedTraverse(1000);
-	unorderedTraverse(10000);
-	unorderedTraverse(100000);
-
-	// Not part of the 3 operation tests - used to see if unordered map remove was O(1) for average case.
-	unorderedRemove(1000);
-	unorderedRemove(10000);
-	unorderedRemove(100000);
 
-	return 0;
+// Benchmarks for every map backend. The suites are templated on the map type so the AVL and B+ tree
+// ordered maps, and the chained and open addressing unordered maps, run the exact same operations on
+// the exact same keys. Keys are drawn up front from a fixed seed, so nothing but the map operations
+// is timed and two runs see identical workloads. The YCSB style workloads replay skewed mixes of reads,
+// updates, inserts, removes and scans, also generated up front. Nothing here checks results: the
+// correctness checks are a separate program, checks.cpp.
+//
+// usage: test [--sizes 1000,10000,100000] [--trials N] [--warmup N] [--seed N] [--csv FILE] [--json FILE]
+//             [--stats FILE] [--memory 1000000,10000000,50000000]
+//
+// --stats writes each map's internal statistics (see Stats.h) after a round of inserts, searches and
+// removes at every size. Counters and latencies are only in it when built with MAP_STATS defined.
+//
+// --memory measures how much memory every backend takes to hold each number of entries, and times
+// nothing. Each backend and size is run in a process of its own (this program again, with
+// --memory-child), so the peak resident size reported is that one map's alone.
+
+// One thread's share of a workload, generated before anything is timed
+struct WorkloadTrace {
+	std::vector<WorkloadOperation> operations;
+	std::vector<int> ids;	// of each operation's record
+	std::vector<string> idText;
+};
+
+// The keys for one map size
+struct KeySet {
+	std::vector<int> present;	// distinct IDs that get inserted, in insertion order
+	std::vector<int> lookups;	// present, shuffled, for searches and removes
+	std::vector<int> missing;	// distinct IDs that are never inserted
+	std::vector<string> presentText;	// the same IDs as the strings the string-keyed maps take
+	std::vector<string> lookupText;
+	std::vector<string> missingText;
+};
+
+KeySet makeKeys(size_t n, unsigned int seed);
+template <typename Map, typename Key>
+void orderedSuite(Benchmark& bench, const char* backend, const std::vector<Key>& present, const std::vector<Key>& lookups, const std::vector<Key>& missing);
+template <typename Map> void unorderedSuite(Benchmark& bench, const char* backend, const KeySet& keys);
+template <typename Map> void concurrentReadMostly(Benchmark& bench, const char* backend, const KeySet& keys, int threads);
+void concurrentOrderedScan(Benchmark& bench, const KeySet& keys, int readers);
+template <typename Map> void orderedPersistence(Benchmark& bench, const char* backend, const KeySet& keys);
+void unorderedPersistence(Benchmark& bench, const KeySet& keys);
+void removeJournal(const std::string& base);
+WorkloadTrace makeTrace(Workload& workload, uint64_t seed, size_t ops);
+template <typename Map> void orderedWorkload(Benchmark& bench, const char* backend, const WorkloadSpec& spec, size_t loaded);
+template <typename Map> void unorderedWorkload(Benchmark& bench, const char* backend, const WorkloadSpec& spec, size_t loaded);
+void concurrentWorkload(Benchmark& bench, const WorkloadSpec& spec, size_t loaded, int threads);
+template <typename Map, typename Key>
+void orderedStats(std::ostream& out, const char* backend, const std::vector<Key>& present, const std::vector<Key>& lookups, const std::vector<Key>& missing);
+template <typename Map> void unorderedStats(std::ostream& out, const char* backend, const KeySet& keys);
+std::vector<size_t> parseSizes(const char* list);
+void memoryChild(int backend, size_t n);
+template <typename Map> void orderedMemory(const char* backend, size_t n, size_t baseline);
+template <typename Map> void unorderedMemory(const char* backend, size_t n, size_t baseline);
+void printMemoryRow(const char* backend, size_t n, const MemoryUsage& usage, size_t baseline);
+
+// The backends --memory measures, numbered as --memory-child takes them
+const char* const MEMORY_BACKENDS[] = { "AVL, int keys", "B+ tree, int keys", "chained", "open addressing" };
+
+// UnorderedMap behind one global mutex, the baseline for ConcurrentUnorderedMap
+class LockedUnorderedMap {
+private:
+	std::mutex lock;
+	UnorderedMap map;
+
+public:
+	LockedUnorderedMap(unsigned int bucketCount, double loadFactor) : map(bucketCount, loadFactor) {}
+	bool find(std::string_view key, string& value) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto iter = map.find(key);
+		if (iter == map.end())
+			return false;
+		value = (*iter).second;
+		return true;
+	}
+	void upsert(std::string_view key, string const& value) {
+		std::lock_guard<std::mutex> guard(lock);
+		map[string(key)] = value;
+	}
+	size_t size() {
+		std::lock_guard<std::mutex> guard(lock);
+		return map.size();
+	}
+};
+
+// Whether a search found something, for searches that return a name or a pointer to one
+inline bool found(const string& value) {
+	return !value.empty();
 }
 
-void orderedInsert(int n) {
-	OrderedMap map;
+inline bool found(const string* value) {
+	return value != nullptr;
+}
 
-	// Start clock
-	auto t1 = high_resolution_clock::now();
+int main(int argc, char** argv) {
+	BenchmarkOptions options;
+	std::vector<size_t> sizes = { 1000, 10000, 100000 };
+	const char* csvPath = nullptr;
+	const char* jsonPath = nullptr;
+	const char* statsPath = nullptr;
+	std::vector<size_t> memorySizes;
+	int memoryBackend = -1;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--trials") == 0) {
+			options.trials = std::max(1, std::atoi(argv[i + 1]));
+		}
+		else if (std::strcmp(argv[i], "--warmup") == 0) {
+			options.warmup = std::max(0, std::atoi(argv[i + 1]));
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0) {
+			options.seed = (unsigned int)std::strtoul(argv[i + 1], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--sizes") == 0) {
+			sizes = parseSizes(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--csv") == 0) {
+			csvPath = argv[i + 1];
+		}
+		else if (std::strcmp(argv[i], "--json") == 0) {
+			jsonPath = argv[i + 1];
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0) {
+			statsPath = argv[i + 1];
+		}
+		else if (std::strcmp(argv[i], "--memory") == 0) {
+			memorySizes = parseSizes(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--memory-child") == 0) {
+			memoryBackend = std::atoi(argv[i + 1]);
+		}
+		else {
+			std::cerr << "unknown option " << argv[i] << endl;
+			return 1;
+		}
+	}
+	sizes.erase(std::remove(sizes.begin(), sizes.end(), 0), sizes.end());
+	if (sizes.empty()) {
+		std::cerr << "no sizes to run" << endl;
+		return 1;
+	}
 
-	// Insert n randomly generated keys
-	for (int i = 0; i < n; i++) {
-		map.insert(to_string(Random::RandomInt(0, 99999999)), "test");
+	if (memoryBackend >= 0) {
+		memoryChild(memoryBackend, sizes.back());
+		return 0;
+	}
+	if (!memorySizes.empty()) {
+		std::printf("%-18s %10s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "backend", "entries", "B/entry", "total MB",
+			"table", "nodes", "free", "keys", "values", "RSS +MB", "peak MB");
+		for (size_t n : memorySizes) {
+			for (int backend = 0; backend < (int)(sizeof(MEMORY_BACKENDS) / sizeof(MEMORY_BACKENDS[0])); backend++) {
+				std::fflush(stdout);
+				string command = "\"" + string(argv[0]) + "\" --sizes " + to_string(n) + " --memory-child " + to_string(backend);
+				if (std::system(command.c_str()) != 0) {
+					std::printf("%-18s %10zu  failed, probably out of memory\n", MEMORY_BACKENDS[backend], n);
+				}
+			}
+		}
+		return 0;
 	}
 
-	// Stop clock
-	auto t2 = high_resolution_clock::now();
+	if (statsPath) {
+		std::ofstream stats(statsPath);
+		for (size_t n : sizes) {
+			KeySet keys = makeKeys(n, options.seed);
+			orderedStats<OrderedMap<int, string>>(stats, "AVL, int keys", keys.present, keys.lookups, keys.missing);
+			orderedStats<BPlusOrderedMap<int, string>>(stats, "B+ tree, int keys", keys.present, keys.lookups, keys.missing);
+			unorderedStats<UnorderedMap>(stats, "chained", keys);
+			unorderedStats<FlatUnorderedMap>(stats, "open addressing", keys);
+		}
+	}
 
-	// Convert to seconds
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
+	Benchmark bench(options);
+	for (size_t n : sizes) {
+		KeySet keys = makeKeys(n, options.seed);
 
-	// Print findings
-	cout << "Time for " << n << " inserts in ordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
-}
+		// Ordered maps, keyed by the string IDs the project started with and by plain ints
+		orderedSuite<StringIDOrderedMap>(bench, "AVL, string IDs", keys.presentText, keys.lookupText, keys.missingText);
+		orderedSuite<StringIDBPlusOrderedMap>(bench, "B+ tree, string IDs", keys.presentText, keys.lookupText, keys.missingText);
+		orderedSuite<OrderedMap<int, string>>(bench, "AVL, int keys", keys.present, keys.lookups, keys.missing);
+		orderedSuite<BPlusOrderedMap<int, string>>(bench, "B+ tree, int keys", keys.present, keys.lookups, keys.missing);
 
-void unorderedInsert(int n) {
-	UnorderedMap map(100, 0.80);
+		// Unordered maps, chained and open addressing
+		unorderedSuite<UnorderedMap>(bench, "chained", keys);
+		unorderedSuite<FlatUnorderedMap>(bench, "open addressing", keys);
+	}
 
-	auto t1 = high_resolution_clock::now();
-	for (int i = 0; i < n; i++) {
-		map[to_string(Random::RandomInt(0, 99999999))] = "test";
+	// Threads and disk only at the largest size, where they matter
+	KeySet keys = makeKeys(sizes.back(), options.seed);
+	for (int threads : { 1, 2, 4 }) {
+		concurrentReadMostly<LockedUnorderedMap>(bench, "locked chained", keys, threads);
+		concurrentReadMostly<ConcurrentUnorderedMap>(bench, "concurrent chained", keys, threads);
+	}
+	for (int readers : { 1, 2, 4 }) {
+		concurrentOrderedScan(bench, keys, readers);
+	}
+	orderedPersistence<OrderedMap<int, string>>(bench, "AVL, int keys", keys);
+	orderedPersistence<BPlusOrderedMap<int, string>>(bench, "B+ tree, int keys", keys);
+	unorderedPersistence(bench, keys);
+
+	// Skewed workloads, with uniform and hotspot versions of B to compare against YCSB's zipfian one
+	WorkloadSpec uniformB = WorkloadSpec::ycsbB();
+	uniformB.name = "uniform B";
+	uniformB.distribution = WorkloadSpec::UNIFORM;
+	WorkloadSpec hotspotB = WorkloadSpec::ycsbB();
+	hotspotB.name = "hotspot B";
+	hotspotB.distribution = WorkloadSpec::HOTSPOT;
+	for (const WorkloadSpec& spec : { WorkloadSpec::ycsbA(), WorkloadSpec::ycsbB(), WorkloadSpec::ycsbC(),
+		WorkloadSpec::ycsbD(), WorkloadSpec::ycsbE(), WorkloadSpec::churn(), uniformB, hotspotB }) {
+		orderedWorkload<OrderedMap<int, string>>(bench, "AVL, int keys", spec, sizes.back());
+		orderedWorkload<BPlusOrderedMap<int, string>>(bench, "B+ tree, int keys", spec, sizes.back());
+		unorderedWorkload<UnorderedMap>(bench, "chained", spec, sizes.back());
+		unorderedWorkload<FlatUnorderedMap>(bench, "open addressing", spec, sizes.back());
+	}
+	for (int threads : { 1, 2, 4 }) {
+		concurrentWorkload(bench, WorkloadSpec::ycsbA(), sizes.back(), threads);
+		concurrentWorkload(bench, WorkloadSpec::ycsbB(), sizes.back(), threads);
 	}
-	auto t2 = high_resolution_clock::now();
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
 
-	cout << "Time for " << n << " inserts in unordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
+	bench.writeTable(cout);
+	if (csvPath) {
+		std::ofstream csv(csvPath);
+		bench.writeCsv(csv);
+	}
+	if (jsonPath) {
+		std::ofstream json(jsonPath);
+		bench.writeJson(json);
+	}
+	return 0;
 }
 
-void orderedSearch(int n) {
-	OrderedMap map;
-
-	// Insert n randomly generated keys
-	for (int i = 0; i < n; i++) {
-		map.insert(to_string(Random::RandomInt(0, 99999999)), "test");
+// Draws 2n distinct 8 digit IDs: the first n are inserted, the rest are guaranteed misses. Random is
+// reseeded from seed and n, so a size's keys don't depend on which sizes ran before it
+KeySet makeKeys(size_t n, unsigned int seed) {
+	Random::Seed(seed + (unsigned int)n);
+	KeySet keys;
+	std::unordered_set<int> drawn;
+	while (drawn.size() < 2 * n) {
+		int id = Random::RandomInt(0, 99999999);
+		if (drawn.insert(id).second) {
+			(keys.present.size() < n ? keys.present : keys.missing).push_back(id);
+		}
 	}
-
-	// Start clock
-	auto t1 = high_resolution_clock::now();
-
-	// Randomly generate n keys and search for the key in the map
-	for (int i = 0; i < n; i++) {
-		map.search(to_string(Random::RandomInt(0, 99999999)));
+	keys.lookups = keys.present;
+	for (size_t i = n - 1; i > 0; i--) {
+		std::swap(keys.lookups[i], keys.lookups[Random::RandomInt(0, (int)i)]);
 	}
+	for (size_t i = 0; i < n; i++) {
+		keys.presentText.push_back(to_string(keys.present[i]));
+		keys.lookupText.push_back(to_string(keys.lookups[i]));
+		keys.missingText.push_back(to_string(keys.missing[i]));
+	}
+	return keys;
+}
+
+template <typename Map, typename Key>
+void orderedSuite(Benchmark& bench, const char* backend, const std::vector<Key>& present, const std::vector<Key>& lookups, const std::vector<Key>& missing) {
+	const size_t n = present.size();
+	const string name = "test";
+	std::unique_ptr<Map> map;
+	auto fresh = [&]() { map.reset(new Map()); };
+	auto filled = [&]() {
+		fresh();
+		for (const Key& key : present) {
+			map->insert(key, name);
+		}
+	};
+	auto none = []() {};
+
+	bench.run("insert", backend, n, n, fresh, [&](size_t first, size_t last) {
+		size_t added = 0;
+		for (size_t i = first; i < last; i++) {
+			added += map->insert(present[i], name);
+		}
+		return added;
+	});
+
+	std::vector<std::pair<Key, string>> records;
+	bench.runWhole("bulk load", backend, n, n, [&]() {
+		fresh();
+		records.clear();
+		for (const Key& key : present) {
+			records.emplace_back(key, name);
+		}
+	}, [&]() {
+		return map->bulkLoad(std::move(records));
+	});
+
+	// searches and traversals don't change the map, so every trial shares one
+	filled();
+	bench.run("search hit", backend, n, n, none, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			hits += found(map->search(lookups[i]));
+		}
+		return hits;
+	});
+	bench.run("search miss", backend, n, n, none, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			hits += found(map->search(missing[i]));
+		}
+		return hits;
+	});
+	bench.runWhole("iterate", backend, n, n, none, [&]() {
+		size_t visited = 0;
+		for (auto iter = map->begin(); iter != map->end(); ++iter) {
+			visited++;
+		}
+		return visited;
+	});
+
+	bench.run("remove", backend, n, n, filled, [&](size_t first, size_t last) {
+		size_t removed = 0;
+		for (size_t i = first; i < last; i++) {
+			removed += map->remove(lookups[i]);
+		}
+		return removed;
+	});
+}
 
-	// Stop clock
-	auto t2 = high_resolution_clock::now();
+template <typename Map>
+void unorderedSuite(Benchmark& bench, const char* backend, const KeySet& keys) {
+	const size_t n = keys.presentText.size();
+	const string name = "test";
+	std::unique_ptr<Map> map;
+	auto fresh = [&]() { map.reset(new Map(100, 0.80)); };
+	auto filled = [&]() {
+		fresh();
+		for (const string& key : keys.presentText) {
+			(*map)[key] = name;
+		}
+	};
+	auto none = []() {};
+
+	bench.run("insert", backend, n, n, fresh, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			(*map)[keys.presentText[i]] = name;
+		}
+		return last - first;
+	});
+
+	// contains() never inserts, so these measure lookups only
+	filled();
+	bench.run("search hit", backend, n, n, none, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			hits += map->contains(keys.lookupText[i]);
+		}
+		return hits;
+	});
+	bench.run("search miss", backend, n, n, none, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			hits += map->contains(keys.missingText[i]);
+		}
+		return hits;
+	});
+
+	// the same hits resolved a block at a time through findBatch()
+	std::vector<std::string_view> views(keys.lookupText.begin(), keys.lookupText.end());
+	std::vector<const string*> values(n);
+	bench.run("batch search hit", backend, n, n, none, [&](size_t first, size_t last) {
+		map->findBatch(views.data() + first, last - first, values.data() + first);
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			hits += values[i] != nullptr;
+		}
+		return hits;
+	});
+
+	bench.runWhole("iterate", backend, n, n, none, [&]() {
+		size_t visited = 0;
+		for (auto iter = map->begin(); iter != map->end(); ++iter) {
+			visited++;
+		}
+		return visited;
+	});
+
+	bench.run("remove", backend, n, n, filled, [&](size_t first, size_t last) {
+		// remove() doesn't say whether it found the key, so the drop in size counts the removals
+		size_t before = map->size();
+		for (size_t i = first; i < last; i++) {
+			map->remove(keys.lookupText[i]);
+		}
+		return before - map->size();
+	});
+}
 
-	// Convert to seconds
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
+// A 95% read / 5% write load from several threads, half of the reads hits
+template <typename Map>
+void concurrentReadMostly(Benchmark& bench, const char* backend, const KeySet& keys, int threads) {
+	const size_t n = keys.presentText.size();
+	const size_t opsPerThread = 10 * n;
+
+	// each thread starts at its own offset into the key lists
+	std::vector<std::vector<const string*>> threadKeys(threads);
+	for (int t = 0; t < threads; t++) {
+		for (size_t i = 0; i < opsPerThread; i++) {
+			size_t index = (i + (size_t)t * n / threads) % n;
+			threadKeys[t].push_back(i % 2 == 0 ? &keys.lookupText[index] : &keys.missingText[index]);
+		}
+	}
 
-	cout << "Time for " << n << " searches in ordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
+	std::unique_ptr<Map> map;
+	string label = string(backend) + ", " + to_string(threads) + (threads == 1 ? " thread" : " threads");
+	bench.runWhole("read-mostly", label, n, opsPerThread * threads, [&]() {
+		map.reset(new Map(100, 0.80));
+		for (const string& key : keys.presentText) {
+			map->upsert(key, "test");
+		}
+	}, [&]() {
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.emplace_back([&map, &ownKeys = threadKeys[t]]() {
+				string value;
+				for (size_t i = 0; i < ownKeys.size(); i++) {
+					if (i % 20 == 0)
+						map->upsert(*ownKeys[i], "test");
+					else
+						map->find(*ownKeys[i], value);
+				}
+			});
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		return map->size();
+	});
 }
 
-void unorderedSearch(int n) {
-	UnorderedMap map(100, 0.80);
+// Readers alternate point searches with short range scans of a pinned snapshot while one writer keeps
+// inserting new IDs
+void concurrentOrderedScan(Benchmark& bench, const KeySet& keys, int readers) {
+	const size_t n = keys.presentText.size();
+	std::unique_ptr<ConcurrentOrderedMap> map;
+	string label = "concurrent AVL, " + to_string(readers) + (readers == 1 ? " reader" : " readers");
+	bench.runWhole("scan beside writer", label, n, n * readers, [&]() {
+		map.reset(new ConcurrentOrderedMap());
+		for (const string& key : keys.presentText) {
+			map->insert(key, "test");
+		}
+	}, [&]() {
+		std::thread writer([&map, &keys]() {
+			for (const string& id : keys.missingText) {
+				map->upsert(id, "test");
+			}
+		});
+		std::vector<std::thread> workers;
+		for (int t = 0; t < readers; t++) {
+			workers.emplace_back([&map, &keys, t, n]() {
+				for (size_t i = 0; i < n; i++) {
+					const string& key = keys.lookupText[(i + (size_t)t * 7919) % n];
+					if (i % 100 == 0) {
+						auto snapshot = map->snapshot();
+						int count = 0;
+						for (auto iter = snapshot.lower_bound(key); iter != snapshot.end() && count < 100; ++iter) {
+							count++;
+						}
+					}
+					else {
+						map->search(key);
+					}
+				}
+			});
+		}
+		writer.join();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		return map->size();
+	});
+}
 
-	for (int i = 0; i < n; i++) {
-		map[to_string(Random::RandomInt(0, 99999999))] = "test";
+// Saving a snapshot, loading it back, and inserting through the write-ahead log. The journaled
+// timings stop once every insert is on disk, not just in the log's buffer
+template <typename Map>
+void orderedPersistence(Benchmark& bench, const char* backend, const KeySet& keys) {
+	const size_t n = keys.present.size();
+	const char* path = "ordered.snapshot";
+	const char* base = "ordered.journal";
+	std::unique_ptr<Map> map(new Map());
+	for (int key : keys.present) {
+		map->insert(key, "test");
 	}
 
-	auto t1 = high_resolution_clock::now();
-	for (int i = 0; i < n; i++) {
-		map[to_string(Random::RandomInt(0, 99999999))];
+	bench.runWhole("snapshot save", backend, n, n, []() {}, [&]() { return map->save(path); });
+	bench.runWhole("snapshot load", backend, n, n, [&]() { map.reset(new Map()); }, [&]() {
+		map->load(path);
+		return map->size();
+	});
+	std::remove(path);
+
+	bench.run("journaled insert", backend, n, n, [&]() {
+		map.reset();
+		removeJournal(base);
+		map.reset(new Map());
+		map->openJournal(base);
+	}, [&](size_t first, size_t last) {
+		size_t added = 0;
+		for (size_t i = first; i < last; i++) {
+			added += map->insert(keys.present[i], "test");
+		}
+		if (last == n) {
+			map->syncJournal();
+		}
+		return added;
+	});
+	map.reset();
+	removeJournal(base);
+}
+
+void unorderedPersistence(Benchmark& bench, const KeySet& keys) {
+	const size_t n = keys.presentText.size();
+	const char* backend = "chained";
+	const char* path = "unordered.snapshot";
+	const char* base = "unordered.journal";
+	std::unique_ptr<UnorderedMap> map(new UnorderedMap(100, 0.80));
+	for (const string& key : keys.presentText) {
+		(*map)[key] = "test";
 	}
-	auto t2 = high_resolution_clock::now();
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
 
-	cout << "Time for " << n << " searches in unordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
+	bench.runWhole("snapshot save", backend, n, n, []() {}, [&]() { return map->save(path); });
+	bench.runWhole("snapshot load", backend, n, n, [&]() { map.reset(new UnorderedMap(100, 0.80)); }, [&]() {
+		map->load(path);
+		return map->size();
+	});
+	std::remove(path);
+
+	bench.run("journaled insert", backend, n, n, [&]() {
+		map.reset();
+		removeJournal(base);
+		map.reset(new UnorderedMap(100, 0.80));
+		map->openJournal(base);
+	}, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			(*map)[keys.presentText[i]] = "test";
+		}
+		if (last == n) {
+			map->syncJournal();
+		}
+		return last - first;
+	});
+	map.reset();
+	removeJournal(base);
 }
 
-void orderedTraverse(int n) {
-	OrderedMap map;
+// Deletes the snapshot and log segments a benchmark's journal left behind
+void removeJournal(const std::string& base) {
+	std::remove(Journal::snapshotPath(base).c_str());
+	for (const std::string& segment : Journal::segments(base)) {
+		std::remove(segment.c_str());
+	}
+}
 
-	for (int i = 0; i < n; i++) {
-		map.insert(to_string(Random::RandomInt(0, 99999999)), "test");
+// ops operations from a generator of its own. Inserts claim new records from the workload as they are
+// generated, so the traces of several threads never insert the same record
+WorkloadTrace makeTrace(Workload& workload, uint64_t seed, size_t ops) {
+	WorkloadTrace trace;
+	Workload::Generator generator = workload.generator(seed);
+	for (size_t i = 0; i < ops; i++) {
+		WorkloadOperation operation = generator.next();
+		trace.operations.push_back(operation);
+		trace.ids.push_back(Workload::keyOf(operation.record));
+		trace.idText.push_back(to_string(trace.ids.back()));
 	}
+	return trace;
+}
 
-	auto t1 = high_resolution_clock::now();
-	map.traverse();
-	auto t2 = high_resolution_clock::now();
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
+// Every trial starts from the loaded records and replays the same trace, inserts included
+template <typename Map>
+void orderedWorkload(Benchmark& bench, const char* backend, const WorkloadSpec& spec, size_t loaded) {
+	Workload workload(spec, loaded);
+	WorkloadTrace trace = makeTrace(workload, bench.settings().seed, loaded);
+	const string name = "test";
+	const string updated = "updated";
+	std::unique_ptr<Map> map;
+	bench.run(spec.name, backend, loaded, loaded, [&]() {
+		map.reset(new Map());
+		std::vector<std::pair<int, string>> records;
+		for (uint64_t record = 0; record < loaded; record++) {
+			records.emplace_back(Workload::keyOf(record), name);
+		}
+		map->bulkLoad(std::move(records));
+	}, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			int id = trace.ids[i];
+			switch (trace.operations[i].type) {
+			case WorkloadOperation::READ:
+				hits += found(map->search(id));
+				break;
+			case WorkloadOperation::UPDATE:
+				hits += map->upsert(id, updated);
+				break;
+			case WorkloadOperation::INSERT:
+				hits += map->insert(id, name);
+				break;
+			case WorkloadOperation::REMOVE:
+				hits += map->remove(id);
+				break;
+			case WorkloadOperation::SCAN: {
+				unsigned int count = 0;
+				for (auto iter = map->lower_bound(id); iter != map->end() && count < trace.operations[i].scanLength; ++iter) {
+					count++;
+				}
+				hits += count;
+				break;
+			}
+			}
+		}
+		return hits;
+	});
+}
 
-	cout << "Time for " << n << " operations traversal in ordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
+// Hash maps have no order to scan in, so workloads with scans are left to the ordered maps
+template <typename Map>
+void unorderedWorkload(Benchmark& bench, const char* backend, const WorkloadSpec& spec, size_t loaded) {
+	if (spec.scan > 0)
+		return;
+	Workload workload(spec, loaded);
+	WorkloadTrace trace = makeTrace(workload, bench.settings().seed, loaded);
+	const string name = "test";
+	const string updated = "updated";
+	std::unique_ptr<Map> map;
+	bench.run(spec.name, backend, loaded, loaded, [&]() {
+		map.reset(new Map(100, 0.80));
+		for (uint64_t record = 0; record < loaded; record++) {
+			(*map)[to_string(Workload::keyOf(record))] = name;
+		}
+	}, [&](size_t first, size_t last) {
+		size_t hits = 0;
+		for (size_t i = first; i < last; i++) {
+			const string& id = trace.idText[i];
+			switch (trace.operations[i].type) {
+			case WorkloadOperation::READ:
+				hits += map->contains(id);
+				break;
+			case WorkloadOperation::UPDATE:
+				(*map)[id] = updated;
+				break;
+			case WorkloadOperation::INSERT:
+				hits += map->emplace(id, name);
+				break;
+			case WorkloadOperation::REMOVE:
+				map->remove(id);
+				break;
+			case WorkloadOperation::SCAN:
+				break;
+			}
+		}
+		return hits + map->size();
+	});
 }
 
-void unorderedTraverse(int n) {
-	UnorderedMap map(100, 0.80);
+// The same workload split over several threads, each replaying a trace from its own generator
+void concurrentWorkload(Benchmark& bench, const WorkloadSpec& spec, size_t loaded, int threads) {
+	Workload workload(spec, loaded);
+	std::vector<WorkloadTrace> traces;
+	for (int t = 0; t < threads; t++) {
+		traces.push_back(makeTrace(workload, bench.settings().seed + (uint64_t)t, loaded));
+	}
+	std::unique_ptr<ConcurrentUnorderedMap> map;
+	string label = "concurrent chained, " + to_string(threads) + (threads == 1 ? " thread" : " threads");
+	bench.runWhole(spec.name, label, loaded, loaded * threads, [&]() {
+		map.reset(new ConcurrentUnorderedMap(100, 0.80));
+		for (uint64_t record = 0; record < loaded; record++) {
+			map->upsert(to_string(Workload::keyOf(record)), "test");
+		}
+	}, [&]() {
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.emplace_back([&map, &trace = traces[t]]() {
+				string value;
+				for (size_t i = 0; i < trace.operations.size(); i++) {
+					const string& id = trace.idText[i];
+					switch (trace.operations[i].type) {
+					case WorkloadOperation::READ:
+					case WorkloadOperation::SCAN:
+						map->find(id, value);
+						break;
+					case WorkloadOperation::UPDATE:
+						map->upsert(id, "updated");
+						break;
+					case WorkloadOperation::INSERT:
+						map->insert(id, "test");
+						break;
+					case WorkloadOperation::REMOVE:
+						map->remove(id);
+						break;
+					}
+				}
+			});
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		return map->size();
+	});
+}
 
-	for (int i = 0; i < n; i++) {
-		map[to_string(Random::RandomInt(0, 99999999))] = "test";
+// Inserts every key, searches for each present and missing one, then removes the first half, and
+// reports what the map saw along the way
+template <typename Map, typename Key>
+void orderedStats(std::ostream& out, const char* backend, const std::vector<Key>& present, const std::vector<Key>& lookups, const std::vector<Key>& missing) {
+	Map map;
+	for (const Key& key : present) {
+		map.insert(key, "test");
 	}
+	for (size_t i = 0; i < present.size(); i++) {
+		map.search(lookups[i]);
+		map.search(missing[i]);
+	}
+	for (size_t i = 0; i < present.size() / 2; i++) {
+		map.remove(lookups[i]);
+	}
+	out << backend << ", " << present.size() << " inserted: ";
+	map.stats().print(out);
+}
 
-	auto t1 = high_resolution_clock::now();
-	for (auto iter = map.begin(); iter != map.end(); ++iter) {
-		cout << (*iter).first << " " << (*iter).second << endl;
+template <typename Map>
+void unorderedStats(std::ostream& out, const char* backend, const KeySet& keys) {
+	const size_t n = keys.presentText.size();
+	Map map(100, 0.80);
+	for (const string& key : keys.presentText) {
+		map[key] = "test";
 	}
-	auto t2 = high_resolution_clock::now();
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
+	for (size_t i = 0; i < n; i++) {
+		map.contains(keys.lookupText[i]);
+		map.contains(keys.missingText[i]);
+	}
+	for (size_t i = 0; i < n / 2; i++) {
+		map.remove(keys.lookupText[i]);
+	}
+	out << backend << ", " << n << " inserted: ";
+	map.stats().print(out);
+}
 
-	cout << "Time for " << n << " operations traversal in unordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
+// A comma separated list of sizes, such as 1000,10000,100000
+std::vector<size_t> parseSizes(const char* list) {
+	std::vector<size_t> sizes;
+	while (*list) {
+		char* next;
+		size_t size = std::strtoul(list, &next, 10);
+		if (next == list) {
+			break;
+		}
+		sizes.push_back(size);
+		list = *next == ',' ? next + 1 : next;
+	}
+	return sizes;
 }
 
-void unorderedRemove(int n) {
-	UnorderedMap map(100, 0.80);
+// Fills one backend with n entries and prints its row of the --memory table. Keys are computed from
+// the record number rather than drawn and kept, so they take no memory of their own
+void memoryChild(int backend, size_t n) {
+	size_t baseline = currentRss();
+	switch (backend) {
+	case 0:
+		orderedMemory<OrderedMap<int, string>>(MEMORY_BACKENDS[backend], n, baseline);
+		break;
+	case 1:
+		orderedMemory<BPlusOrderedMap<int, string>>(MEMORY_BACKENDS[backend], n, baseline);
+		break;
+	case 2:
+		unorderedMemory<UnorderedMap>(MEMORY_BACKENDS[backend], n, baseline);
+		break;
+	case 3:
+		unorderedMemory<FlatUnorderedMap>(MEMORY_BACKENDS[backend], n, baseline);
+		break;
+	}
+}
 
-	for (int i = 0; i < n; i++) {
-		map[to_string(n)] = "test";
+template <typename Map>
+void orderedMemory(const char* backend, size_t n, size_t baseline) {
+	Map map;
+	for (uint64_t record = 0; record < n; record++) {
+		map.insert(Workload::keyOf(record), "test");
 	}
+	printMemoryRow(backend, n, map.memoryUsage(), baseline);
+}
 
-	auto t1 = high_resolution_clock::now();
-	for (int i = 0; i < n; i++) {
-		map.remove(to_string(n));
+template <typename Map>
+void unorderedMemory(const char* backend, size_t n, size_t baseline) {
+	Map map(100, 0.80);
+	for (uint64_t record = 0; record < n; record++) {
+		map[to_string(Workload::keyOf(record))] = "test";
 	}
-	auto t2 = high_resolution_clock::now();
-	auto exeTime = duration_cast<duration<double>>(t2 - t1);
+	printMemoryRow(backend, n, map.memoryUsage(), baseline);
+}
 
-	cout << "Time for " << n << " removes in unordered map: " << exeTime.count() << " seconds" << endl;
-	cout << "Size of map: " << map.size() << endl;
-}
\ No newline at end of file
+// Sizes in MB. The resident size is taken while the map is still alive
+void printMemoryRow(const char* backend, size_t n, const MemoryUsage& usage, size_t baseline) {
+	const double MB = 1024.0 * 1024.0;
+	size_t resident = currentRss();
+	std::printf("%-18s %10zu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", backend, n,
+		(double)usage.total() / (double)std::max<size_t>(n, 1), usage.total() / MB, usage.table / MB, usage.nodes / MB,
+		usage.freeNodes / MB, usage.keys / MB, usage.values / MB, (resident > baseline ? resident - baseline : 0) / MB,
+		peakRss() / MB);
+	std::fflush(stdout);
+}